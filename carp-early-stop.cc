@@ -0,0 +1,208 @@
+/* Online statistics and confidence-interval stopping rule for CARP experiment runs */
+
+#include "carp-early-stop.h"
+#include "ns3/log.h"
+#include "ns3/abort.h"
+#include "ns3/simulator.h"
+#include <algorithm>
+#include <cmath>
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("CarpEarlyStop");
+
+namespace carp {
+
+// Markers start at the first five samples; see Jain and Chlamtac, CACM 28(10), 1985
+QuantileSketch::QuantileSketch (double p)
+  : m_p (p),
+    m_count (0)
+{
+  NS_ABORT_MSG_UNLESS (p > 0 && p < 1, "Quantile must be in (0,1)");
+  double np[5] = { 0, 2 * p, 4 * p, 2 + 2 * p, 4 };
+  double dn[5] = { 0, p / 2, p, (1 + p) / 2, 1 };
+  for (int i = 0; i < 5; ++i)
+    {
+      m_q[i] = 0;
+      m_n[i] = i;
+      m_np[i] = np[i];
+      m_dn[i] = dn[i];
+    }
+}
+
+void
+QuantileSketch::Add (double x)
+{
+  if (m_count < 5)
+    {
+      m_q[m_count++] = x;
+      if (m_count == 5)
+        {
+          std::sort (m_q, m_q + 5);
+        }
+      return;
+    }
+  int k;
+  if (x < m_q[0])
+    {
+      m_q[0] = x;
+      k = 0;
+    }
+  else if (x >= m_q[4])
+    {
+      m_q[4] = x;
+      k = 3;
+    }
+  else
+    {
+      k = 0;
+      while (x >= m_q[k + 1])
+        {
+          k++;
+        }
+    }
+  m_count++;
+  for (int i = k + 1; i < 5; ++i)
+    {
+      m_n[i]++;
+    }
+  for (int i = 0; i < 5; ++i)
+    {
+      m_np[i] += m_dn[i];
+    }
+  // Move the middle markers towards their desired positions, one step at a time
+  for (int i = 1; i < 4; ++i)
+    {
+      double d = m_np[i] - m_n[i];
+      if ((d >= 1 && m_n[i + 1] - m_n[i] > 1) || (d <= -1 && m_n[i - 1] - m_n[i] < -1))
+        {
+          int s = d >= 0 ? 1 : -1;
+          double q = Parabolic (i, s);
+          m_q[i] = (m_q[i - 1] < q && q < m_q[i + 1]) ? q : Linear (i, s);
+          m_n[i] += s;
+        }
+    }
+}
+
+double
+QuantileSketch::Parabolic (int i, double d) const
+{
+  return m_q[i] + d / (m_n[i + 1] - m_n[i - 1])
+    * ((m_n[i] - m_n[i - 1] + d) * (m_q[i + 1] - m_q[i]) / (m_n[i + 1] - m_n[i])
+       + (m_n[i + 1] - m_n[i] - d) * (m_q[i] - m_q[i - 1]) / (m_n[i] - m_n[i - 1]));
+}
+
+double
+QuantileSketch::Linear (int i, int d) const
+{
+  return m_q[i] + d * (m_q[i + d] - m_q[i]) / (m_n[i + d] - m_n[i]);
+}
+
+double
+QuantileSketch::Get () const
+{
+  if (m_count == 0)
+    {
+      return 0.0;
+    }
+  if (m_count < 5)
+    {
+      double sorted[5];
+      std::copy (m_q, m_q + m_count, sorted);
+      std::sort (sorted, sorted + m_count);
+      return sorted[std::min<uint64_t> (m_count - 1, (uint64_t) (m_p * m_count))];
+    }
+  return m_q[2];
+}
+
+// Normal quantile through Abramowitz and Stegun 26.2.23, within 4.5e-4
+static double
+NormalQuantile (double confidence)
+{
+  double p = (1.0 - confidence) / 2;
+  double t = std::sqrt (-2.0 * std::log (p));
+  return t - (2.515517 + 0.802853 * t + 0.010328 * t * t)
+    / (1.0 + 1.432788 * t + 0.189269 * t * t + 0.001308 * t * t * t);
+}
+
+EarlyStop::EarlyStop (Time batchLength, double confidence)
+  : m_batchLength (batchLength),
+    m_z (NormalQuantile (confidence)),
+    m_pdrHalfWidth (0.0),
+    m_delayHalfWidth (0.0),
+    m_minBatches (10),
+    m_started (false),
+    m_converged (false),
+    m_stopTime (Seconds (0)),
+    m_batchSent (0),
+    m_batchReceived (0),
+    m_batchDelaySum (0.0),
+    m_p99 (0.99)
+{
+  NS_ABORT_MSG_UNLESS (confidence > 0 && confidence < 1, "Confidence must be in (0,1)");
+  NS_ABORT_MSG_UNLESS (batchLength.IsStrictlyPositive (), "Batch length must be positive");
+}
+
+void
+EarlyStop::Start (Time start)
+{
+  Simulator::Schedule (start, &EarlyStop::CloseBatch, this);
+}
+
+void
+EarlyStop::NotifySent ()
+{
+  if (m_started)
+    {
+      m_batchSent++;
+    }
+}
+
+void
+EarlyStop::NotifyReceived (Time delay)
+{
+  if (!m_started)
+    {
+      return;
+    }
+  m_batchReceived++;
+  m_batchDelaySum += delay.GetSeconds ();
+  m_p99.Add (delay.GetSeconds ());
+}
+
+void
+EarlyStop::CloseBatch ()
+{
+  if (m_started && m_batchSent > 0)
+    {
+      m_pdr.Add (std::min (1.0, (double) m_batchReceived / m_batchSent));
+    }
+  if (m_started && m_batchReceived > 0)
+    {
+      m_batchDelay.Add (m_batchDelaySum / m_batchReceived);
+    }
+  m_started = true;
+  m_batchSent = 0;
+  m_batchReceived = 0;
+  m_batchDelaySum = 0.0;
+
+  bool pdrDone = m_pdrHalfWidth <= 0
+    || (m_pdr.GetCount () >= m_minBatches && m_pdr.GetHalfWidth (m_z) <= m_pdrHalfWidth);
+  bool delayDone = m_delayHalfWidth <= 0
+    || (m_batchDelay.GetCount () >= m_minBatches
+        && m_batchDelay.GetHalfWidth (m_z) <= m_delayHalfWidth * m_batchDelay.GetMean ());
+  if (pdrDone && delayDone && (m_pdrHalfWidth > 0 || m_delayHalfWidth > 0))
+    {
+      NS_LOG_INFO ("Converged after " << m_pdr.GetCount () << " batches: PDR " << m_pdr.GetMean ()
+                   << " +- " << m_pdr.GetHalfWidth (m_z) << ", delay " << m_batchDelay.GetMean ()
+                   << " +- " << m_batchDelay.GetHalfWidth (m_z));
+      m_converged = true;
+      m_stopTime = Simulator::Now ();
+      Simulator::Stop ();
+      return;
+    }
+  Simulator::Schedule (m_batchLength, &EarlyStop::CloseBatch, this);
+}
+
+} // namespace carp
+} // namespace ns3
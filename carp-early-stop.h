@@ -0,0 +1,91 @@
+/* Online statistics and confidence-interval stopping rule for CARP experiment runs */
+
+#ifndef CARP_EARLY_STOP_H
+#define CARP_EARLY_STOP_H
+
+#include "ns3/simple-ref-count.h"
+#include "ns3/nstime.h"
+#include "ns3/carp-running-stats.h"
+
+namespace ns3 {
+namespace carp {
+
+/// Single quantile estimated with the P-square algorithm: five markers, no samples kept
+class QuantileSketch
+{
+public:
+  QuantileSketch (double p);
+  void Add (double x);
+  uint64_t GetCount () const { return m_count; }
+  /// Current estimate, exact below five samples and 0 without any
+  double Get () const;
+
+private:
+  double Parabolic (int i, double d) const;
+  double Linear (int i, int d) const;
+
+  double m_p;
+  uint64_t m_count;
+  double m_q[5]; // Marker heights
+  double m_n[5]; // Marker positions
+  double m_np[5]; // Desired marker positions
+  double m_dn[5]; // Desired position increments
+};
+
+/*
+ * Stops the simulation once the tracked metrics are known precisely enough.
+ * Delivery ratio and mean delay are averaged per batch of BatchLength so that
+ * successive samples are close to independent (batch means), and the run stops
+ * after the first batch at which every requested half width is met, with at
+ * least MinBatches batches. A half width of zero leaves that metric untracked.
+ * Packets still in flight at the end of a batch count as lost in it.
+ */
+class EarlyStop : public SimpleRefCount<EarlyStop>
+{
+public:
+  EarlyStop (Time batchLength, double confidence = 0.95);
+
+  /// Largest accepted half width of the delivery ratio interval (absolute)
+  void SetPdrHalfWidth (double w) { m_pdrHalfWidth = w; }
+  /// Largest accepted half width of the mean delay interval, relative to the mean
+  void SetDelayHalfWidth (double w) { m_delayHalfWidth = w; }
+  void SetMinBatches (uint32_t n) { m_minBatches = n; }
+  /// Open the first batch after start, typically the end of the warm-up
+  void Start (Time start);
+
+  void NotifySent ();
+  void NotifyReceived (Time delay);
+
+  bool IsConverged () const { return m_converged; }
+  /// Simulation time at which the run converged
+  Time GetStopTime () const { return m_stopTime; }
+  const RunningStats &GetPdr () const { return m_pdr; }
+  const RunningStats &GetDelay () const { return m_batchDelay; }
+  /// Normal quantile of the confidence level, to pass to RunningStats::GetHalfWidth
+  double GetZ () const { return m_z; }
+  /// Per-packet delay 99th percentile
+  double GetDelayP99 () const { return m_p99.Get (); }
+
+private:
+  void CloseBatch ();
+
+  Time m_batchLength;
+  double m_z; // Normal quantile of the requested confidence
+  double m_pdrHalfWidth;
+  double m_delayHalfWidth;
+  uint32_t m_minBatches;
+  bool m_started;
+  bool m_converged;
+  Time m_stopTime;
+  uint64_t m_batchSent;
+  uint64_t m_batchReceived;
+  double m_batchDelaySum;
+  RunningStats m_pdr; // One sample per batch
+  RunningStats m_batchDelay; // One sample per batch
+  QuantileSketch m_p99;
+};
+
+} // namespace carp
+} // namespace ns3
+
+#endif /* CARP_EARLY_STOP_H */
@@ -3,9 +3,11 @@
 #include <vector>
 #include <list>
 #include <ostream>
+#include <algorithm>
 #include "ns3/header.h"
 #include "ns3/ipv4-address.h"
 #include "ns3/carp-header.h"
+#include "ns3/address-utils.h"
 
 
 namespace ns3
@@ -62,6 +64,7 @@ TypeHeader::Deserialize (Buffer::Iterator start)
    case CARPTYPE_PONG: 
    case CARPTYPE_HELLO:  
    case CARPTYPE_DATA_ACK:
+   case CARPTYPE_DATA_PING:
       {
         m_type = (MessageType) type;
         break;
@@ -99,6 +102,11 @@ TypeHeader::Print (std::ostream &os) const
         os << "DATA_ACK";
         break;
       }
+    case CARPTYPE_DATA_PING:
+      {
+        os << "DATA_PING";
+        break;
+      }
     default:
       os << "UNKNOWN_TYPE";
     }
@@ -122,8 +130,8 @@ operator<< (std::ostream & os, TypeHeader const & h)
 // PING
 //-----------------------------------------------------------------------------
 // A chained constructor to declare the default fields in the Ping headers
-PingHeader::PingHeader (uint32_t num_pkt, Ipv4Address origin) :
-  m_num_pkt (num_pkt), m_origin (origin)
+PingHeader::PingHeader (uint32_t num_pkt, Ipv4Address origin, uint8_t hopCount) :
+  m_num_pkt (num_pkt), m_origin (origin), m_hopCount (hopCount)
 {
 }
 
@@ -150,7 +158,7 @@ PingHeader::GetInstanceTypeId () const
 uint32_t
 PingHeader::GetSerializedSize () const
 {
-  return 23;   //What is the seriaLized sIze of a PING packet?
+  return 6;   // Packet count, origin and hop count
 }
 
 // Serialize the PING header
@@ -159,6 +167,7 @@ PingHeader::Serialize (Buffer::Iterator i) const
 {
   i.WriteU8 (m_num_pkt);
   WriteTo (i, m_origin);
+  i.WriteU8 (m_hopCount);
   
 }
 
@@ -168,6 +177,7 @@ PingHeader::Deserialize (Buffer::Iterator start)
   Buffer::Iterator i = start;
   m_num_pkt = i.ReadU8 ();
   ReadFrom (i, m_origin);
+  m_hopCount = i.ReadU8 ();
 
   uint32_t dist = i.GetDistanceFrom (start);
   NS_ASSERT (dist == GetSerializedSize ());
@@ -177,7 +187,8 @@ PingHeader::Deserialize (Buffer::Iterator start)
 void
 PingHeader::Print (std::ostream &os) const
 {
-  os << " source: ipv4 "<< m_origin << " Number of packets " << m_num_pkt;
+  os << " source: ipv4 "<< m_origin << " Number of packets " << m_num_pkt
+     << " hop count " << (uint32_t) m_hopCount;
 
 }
 
@@ -191,7 +202,7 @@ operator<< (std::ostream & os, PingHeader const & h)
 bool
 PingHeader::operator== (PingHeader const & o) const
 {
-  return (m_num_pkt == o.m_num_pkt && m_origin == o.m_origin );
+  return (m_num_pkt == o.m_num_pkt && m_origin == o.m_origin && m_hopCount == o.m_hopCount );
 }
 
 
@@ -201,14 +212,14 @@ PingHeader::operator== (PingHeader const & o) const
 
 PongHeader::PongHeader (uint8_t queue, uint8_t hopCount,
  Ipv4Address dst, Ipv4Address origin,  double energy, double linkQuality) :
-  m_queue (queue), m_origin (origin), m_hopCount(hopCount),
-  m_energy(energy), m_linkQuality(linkQuality), m_dst(dst)
+  m_queue (queue), m_hopCount (hopCount), m_dst (dst), m_origin (origin),
+  m_energy (energy), m_linkQuality (linkQuality)
 {
 }
 
-NS_OBJECT_ENSURE_REGISTERED (PingHeader);
+NS_OBJECT_ENSURE_REGISTERED (PongHeader);
 
-//The use Of typeid to define the PingHeader information
+//The use Of typeid to define the PongHeader information
 TypeId
 PongHeader::GetTypeId ()
 {
@@ -229,7 +240,7 @@ PongHeader::GetInstanceTypeId () const
 uint32_t
 PongHeader::GetSerializedSize () const
 {
-  return 23;   //What is the seriaLized sIze of a PING packet?
+  return 12;   // Queue, energy, hop count, link quality and two addresses
 }
 
 // Serialize the PING header
@@ -237,9 +248,9 @@ void
 PongHeader::Serialize (Buffer::Iterator i) const
 {
   i.WriteU8 (m_queue);
-  i.WriteU8 (m_energy);
+  i.WriteU8 ((uint8_t) (std::min (1.0, std::max (0.0, m_energy)) * 255.0 + 0.5));
   i.WriteU8 (m_hopCount);
-  i.WriteU8 (m_linkQuality);
+  i.WriteU8 ((uint8_t) (std::min (1.0, std::max (0.0, m_linkQuality)) * 255.0 + 0.5));
   WriteTo (i, m_origin);
   WriteTo (i, m_dst);
   
@@ -250,9 +261,9 @@ PongHeader::Deserialize (Buffer::Iterator start)
 {
   Buffer::Iterator i = start;
   m_queue = i.ReadU8 ();
-  m_energy = i.ReadU8 ();
-  i.WriteU8 (m_hopCount);
-  i.WriteU8 (m_linkQuality);
+  m_energy = i.ReadU8 () / 255.0;
+  m_hopCount = i.ReadU8 ();
+  m_linkQuality = i.ReadU8 () / 255.0;
   ReadFrom (i, m_origin);
   ReadFrom (i, m_dst);
 
@@ -265,8 +276,8 @@ void
 PongHeader::Print (std::ostream &os) const
 {
   os << " source: ipv4 "<< m_origin << " Residual energy " << m_energy
-     << " dest ipv4 " << m_dst << " hop count "<< m_hopCount 
-     << " link quality " << m_linkQuality << " Buffer size " << m_queue;
+     << " dest ipv4 " << m_dst << " hop count "<< (uint32_t) m_hopCount
+     << " link quality " << m_linkQuality << " Buffer size " << (uint32_t) m_queue;
 
 }
 
@@ -290,13 +301,13 @@ PongHeader::operator== (PongHeader const & o) const
 //-----------------------------------------------------------------------------
 // A chained constructor to declare the default fields in the Hello header
 HelloHeader::HelloHeader (uint32_t hopCount, Ipv4Address origin) :
-  m_hopCount (hopCount), m_origin (origin)
+  m_hopCount (hopCount), m_origin (origin), m_position (Vector ()), m_round (0), m_sink (Ipv4Address ())
 {
 }
 
-NS_OBJECT_ENSURE_REGISTERED (PingHeader);
+NS_OBJECT_ENSURE_REGISTERED (HelloHeader);
 
-//The use Of typeid to define the PingHeader information
+//The use Of typeid to define the HelloHeader information
 TypeId
 HelloHeader::GetTypeId ()
 {
@@ -317,7 +328,7 @@ HelloHeader::GetInstanceTypeId () const
 uint32_t
 HelloHeader::GetSerializedSize () const
 {
-  return 23;   //What is the seriaLized size of a Hello header?
+  return 23;   // Hop count, origin, three 32 bit coordinates, round and sink
 }
 
 // Serialize the PING header
@@ -326,7 +337,11 @@ HelloHeader::Serialize (Buffer::Iterator i) const
 {
   i.WriteU8 (m_hopCount);
   WriteTo (i, m_origin);
-  
+  i.WriteHtonU32 ((uint32_t) (int32_t) (m_position.x * 100.0));
+  i.WriteHtonU32 ((uint32_t) (int32_t) (m_position.y * 100.0));
+  i.WriteHtonU32 ((uint32_t) (int32_t) (m_position.z * 100.0));
+  i.WriteHtonU16 (m_round);
+  WriteTo (i, m_sink);
 }
 
 uint32_t
@@ -335,6 +350,11 @@ HelloHeader::Deserialize (Buffer::Iterator start)
   Buffer::Iterator i = start;
   m_hopCount = i.ReadU8 ();
   ReadFrom (i, m_origin);
+  m_position.x = (int32_t) i.ReadNtohU32 () / 100.0;
+  m_position.y = (int32_t) i.ReadNtohU32 () / 100.0;
+  m_position.z = (int32_t) i.ReadNtohU32 () / 100.0;
+  m_round = i.ReadNtohU16 ();
+  ReadFrom (i, m_sink);
 
   uint32_t dist = i.GetDistanceFrom (start);
   NS_ASSERT (dist == GetSerializedSize ());
@@ -344,7 +364,8 @@ HelloHeader::Deserialize (Buffer::Iterator start)
 void
 HelloHeader::Print (std::ostream &os) const
 {
-  os << " source: ipv4 "<< m_origin << " Hop Count " << m_hopCount;
+  os << " source: ipv4 "<< m_origin << " Hop Count " << m_hopCount
+     << " position " << m_position << " round " << m_round << " sink " << m_sink;
 
 }
 
@@ -358,10 +379,145 @@ operator<< (std::ostream & os, HelloHeader const & h)
 bool
 HelloHeader::operator== (HelloHeader const & o) const
 {
-  return (m_hopCount == o.m_hopCount && m_origin == o.m_origin );
+  return (m_hopCount == o.m_hopCount && m_origin == o.m_origin && m_round == o.m_round && m_sink == o.m_sink);
+}
+
+
+//-----------------------------------------------------------------------------
+// DATA_ACK
+//-----------------------------------------------------------------------------
+DataAckHeader::DataAckHeader (Ipv4Address origin, uint16_t id) :
+  m_origin (origin), m_id (id)
+{
+}
+
+NS_OBJECT_ENSURE_REGISTERED (DataAckHeader);
+
+TypeId
+DataAckHeader::GetTypeId ()
+{
+  static TypeId tid = TypeId ("ns3::carp::DataAckHeader")
+    .SetParent<Header> ()
+    .SetGroupName("Carp")
+    .AddConstructor<DataAckHeader> ()
+  ;
+  return tid;
+}
+
+TypeId
+DataAckHeader::GetInstanceTypeId () const
+{
+  return GetTypeId ();
+}
+
+uint32_t
+DataAckHeader::GetSerializedSize () const
+{
+  return 6;   // Origin and IP identification
+}
+
+void
+DataAckHeader::Serialize (Buffer::Iterator i) const
+{
+  WriteTo (i, m_origin);
+  i.WriteHtonU16 (m_id);
 }
 
+uint32_t
+DataAckHeader::Deserialize (Buffer::Iterator start)
+{
+  Buffer::Iterator i = start;
+  ReadFrom (i, m_origin);
+  m_id = i.ReadNtohU16 ();
+
+  uint32_t dist = i.GetDistanceFrom (start);
+  NS_ASSERT (dist == GetSerializedSize ());
+  return dist;
+}
+
+void
+DataAckHeader::Print (std::ostream &os) const
+{
+  os << " data source: ipv4 " << m_origin << " identification " << m_id;
+}
 
+std::ostream &
+operator<< (std::ostream & os, DataAckHeader const & h)
+{
+  h.Print (os);
+  return os;
+}
+
+bool
+DataAckHeader::operator== (DataAckHeader const & o) const
+{
+  return (m_origin == o.m_origin && m_id == o.m_id);
+}
+
+//-----------------------------------------------------------------------------
+// AGGREGATE
+//-----------------------------------------------------------------------------
+NS_OBJECT_ENSURE_REGISTERED (AggregateHeader);
+
+AggregateHeader::AggregateHeader ()
+{
+}
+
+TypeId
+AggregateHeader::GetTypeId ()
+{
+  static TypeId tid = TypeId ("ns3::carp::AggregateHeader")
+    .SetParent<Header> ()
+    .SetGroupName("Carp")
+    .AddConstructor<AggregateHeader> ()
+  ;
+  return tid;
+}
+
+TypeId
+AggregateHeader::GetInstanceTypeId () const
+{
+  return GetTypeId ();
+}
+
+uint32_t
+AggregateHeader::GetSerializedSize () const
+{
+  return 1 + 2 * m_sizes.size ();   // Count, then one size per packet
+}
+
+void
+AggregateHeader::Serialize (Buffer::Iterator i) const
+{
+  NS_ASSERT (m_sizes.size () <= 255);
+  i.WriteU8 (m_sizes.size ());
+  for (std::vector<uint16_t>::const_iterator j = m_sizes.begin (); j != m_sizes.end (); ++j)
+    {
+      i.WriteHtonU16 (*j);
+    }
+}
+
+uint32_t
+AggregateHeader::Deserialize (Buffer::Iterator start)
+{
+  Buffer::Iterator i = start;
+  uint8_t n = i.ReadU8 ();
+  m_sizes.clear ();
+  for (uint8_t j = 0; j < n; ++j)
+    {
+      m_sizes.push_back (i.ReadNtohU16 ());
+    }
+
+  uint32_t dist = i.GetDistanceFrom (start);
+  NS_ASSERT (dist == GetSerializedSize ());
+  return dist;
+}
+
+void
+AggregateHeader::Print (std::ostream &os) const
+{
+  os << " aggregate of " << m_sizes.size () << " packets";
+}
 
 } // END of Carp
 } //END of namespace
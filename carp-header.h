@@ -1,10 +1,14 @@
 /* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
 
+#ifndef CARP_HEADER_H
+#define CARP_HEADER_H
+
 #include <vector>
 #include <list>
 #include <ostream>
 #include "ns3/header.h"
 #include "ns3/ipv4-address.h"
+#include "ns3/vector.h"
 
 namespace ns3 {
 namespace carp {
@@ -14,7 +18,8 @@ enum MessageType
   CARPTYPE_PING  = 1,   
   CARPTYPE_PONG  = 2,
   CARPTYPE_HELLO = 3,   
-  CARPTYPE_DATA_ACK = 4    // This kind of message type would be investigated subsequently
+  CARPTYPE_DATA_ACK = 4,   // This kind of message type would be investigated subsequently
+  CARPTYPE_DATA_PING = 5   // PING carrying a small data packet, claimed by the best neighbor
 };
 
 //Description and use cases of Type Header
@@ -37,18 +42,20 @@ public:
   MessageType Get () const { return m_type; }
   /// Check that type if valid
   bool IsValid () const { return m_valid; }
-  //bool operator== (TypeHeader const & o) const;
+  bool operator== (TypeHeader const & o) const;
 private:
   MessageType m_type;
   bool m_valid;
 };
 
+std::ostream & operator<< (std::ostream & os, TypeHeader const &);
+
 
 /* This class is used to define the required fields for the PING packet */
 class PingHeader : public Header 
 {
 public:
-  PingHeader (uint32_t num_pkt = 0, Ipv4Address origin = Ipv4Address ());
+  PingHeader (uint32_t num_pkt = 0, Ipv4Address origin = Ipv4Address (), uint8_t hopCount = 255);
 
   // Header serialization/deserialization
   static TypeId GetTypeId ();
@@ -60,15 +67,18 @@ public:
 
   // Fields
   void PacketCount (uint32_t num_pkt) { m_num_pkt = num_pkt; }
-  uint32_t GetPacketCount () const { return m_requestID; }
+  uint32_t GetPacketCount () const { return m_num_pkt; }
   void SetOrigin (Ipv4Address a) { m_origin = a; }
   Ipv4Address GetOrigin () const { return m_origin; }
+  void SetHopCount (uint8_t count) { m_hopCount = count; }
+  uint8_t GetHopCount () const { return m_hopCount; }
   
 
   bool operator== (PingHeader const & o) const;
 private:
   uint32_t       m_num_pkt;      ///< Number of pkt to be sent by sending node
   Ipv4Address    m_origin;         ///< Originator IP Address
+  uint8_t        m_hopCount;       ///< Hop count of the sender, 255 if unknown
 
 };
 
@@ -95,8 +105,8 @@ class PongHeader : public Header
 {
 public:
   PongHeader (uint8_t queue = 0, uint8_t hopCount = 0, Ipv4Address dst =
-                Ipv4Address (), Ipv4Address origin =Ipv4Address (), double energy = 0.0
-               double linkQualIty = 0.0);
+                Ipv4Address (), Ipv4Address origin =Ipv4Address (), double energy = 0.0,
+               double linkQuality = 0.0);
   // Header serialization/deserialization
   static TypeId GetTypeId ();
   TypeId GetInstanceTypeId () const;
@@ -112,12 +122,12 @@ public:
   Ipv4Address GetDst () const { return m_dst; }
   void SetOrigin (Ipv4Address a) { m_origin = a; }
   Ipv4Address GetOrigin () const { return m_origin; }
-  void SetQueue (uint8_t queue);
-  uint8_t GetQueue () const{return m_queue; };
-  void SetEnergy (double energy);
-  double GetEnergy () const{return m_energy; };
-  void SetLinkQuality (double linkQuality);
-  double GetLinkQuality () const{return m_linkQuality; };
+  void SetQueue (uint8_t queue) { m_queue = queue; }
+  uint8_t GetQueue () const { return m_queue; }
+  void SetEnergy (double energy) { m_energy = energy; }
+  double GetEnergy () const { return m_energy; }
+  void SetLinkQuality (double linkQuality) { m_linkQuality = linkQuality; }
+  double GetLinkQuality () const { return m_linkQuality; }
         
 
   bool operator== (PongHeader const & o) const;
@@ -127,8 +137,8 @@ private:
   uint8_t       m_hopCount;         ///< Hop Count
   Ipv4Address   m_dst;              ///< Destination IP Address
   Ipv4Address   m_origin;           ///< Source IP Address
-  double        m_energy;
-  double        m_linkQuality;
+  double        m_energy;          ///< Residual energy fraction in [0,1], sent quantized to 8 bits
+  double        m_linkQuality;     ///< Link quality in [0,1], sent quantized to 8 bits
 };
 
 std::ostream & operator<< (std::ostream & os, PongHeader const &);
@@ -152,21 +162,84 @@ public:
   uint32_t GetHopCount () const { return m_hopCount; }
   void SetOrigin (Ipv4Address a) { m_origin = a; }
   Ipv4Address GetOrigin () const { return m_origin; }
-  
-  // Method to invoke the Hello packet
-  void SetHello (Ipv4Address src, uint32_t srcSeqNo);
+  // Position of the sender, used by the geographic PING prefilter
+  void SetPosition (Vector position) { m_position = position; }
+  Vector GetPosition () const { return m_position; }
+  // Gradient round, advanced by the sink at every periodic HELLO
+  void SetRound (uint16_t round) { m_round = round; }
+  uint16_t GetRound () const { return m_round; }
+  // Sink that originated the round, passed on unchanged
+  void SetSink (Ipv4Address sink) { m_sink = sink; }
+  Ipv4Address GetSink () const { return m_sink; }
+
 
   bool operator== (HelloHeader const & o) const;
 private:
   uint32_t       m_hopCount;      ///< Hop count of node from sink
   Ipv4Address    m_origin;         ///< Originator IP Address
+  Vector         m_position;       ///< Sender position, sent in centimetres
+  uint16_t       m_round;          ///< Sink HELLO round the hop count belongs to
+  Ipv4Address    m_sink;           ///< Sink IP address
 
 };
 
-std::ostream & operator<< (std::ostream & os, PingHeader const &);
+std::ostream & operator<< (std::ostream & os, HelloHeader const &);
+
+/* DATA_ACK body: identifies the data packet being acknowledged or claimed by its IP source and identification */
+class DataAckHeader : public Header
+{
+public:
+  DataAckHeader (Ipv4Address origin = Ipv4Address (), uint16_t id = 0);
+
+  // Header serialization/deserialization
+  static TypeId GetTypeId ();
+  TypeId GetInstanceTypeId () const;
+  uint32_t GetSerializedSize () const;
+  void Serialize (Buffer::Iterator start) const;
+  uint32_t Deserialize (Buffer::Iterator start);
+  void Print (std::ostream &os) const;
+
+  // Fields
+  void SetOrigin (Ipv4Address a) { m_origin = a; }
+  Ipv4Address GetOrigin () const { return m_origin; }
+  void SetIdentification (uint16_t id) { m_id = id; }
+  uint16_t GetIdentification () const { return m_id; }
+
+  bool operator== (DataAckHeader const & o) const;
+private:
+  Ipv4Address    m_origin;         ///< IP source of the data packet
+  uint16_t       m_id;             ///< IP identification of the data packet
+};
+
+std::ostream & operator<< (std::ostream & os, DataAckHeader const &);
+
+/* Aggregate header: sizes of the IP packets, headers included, concatenated after it */
+class AggregateHeader : public Header
+{
+public:
+  AggregateHeader ();
+
+  // Header serialization/deserialization
+  static TypeId GetTypeId ();
+  TypeId GetInstanceTypeId () const;
+  uint32_t GetSerializedSize () const;
+  void Serialize (Buffer::Iterator start) const;
+  uint32_t Deserialize (Buffer::Iterator start);
+  void Print (std::ostream &os) const;
+
+  // Fields
+  void AddPacket (uint16_t size) { m_sizes.push_back (size); }
+  uint32_t GetNPackets () const { return m_sizes.size (); }
+  uint16_t GetPacketSize (uint32_t i) const { return m_sizes[i]; }
+
+private:
+  std::vector<uint16_t> m_sizes; ///< At most 255 packets
+};
 
 
 
 }
 
 }
+
+#endif /* CARP_HEADER_H */
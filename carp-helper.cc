@@ -1,15 +1,29 @@
 
 //Required libraries
 #include "carp-helper.h"
-#include "ns3/carp-routingprotocol.h"
+#include "ns3/carp-routing-protocol.h"
+#include "ns3/carp-state-writer.h"
+#include "ns3/simulator.h"
 #include "ns3/node-list.h"
 #include "ns3/names.h"
 #include "ns3/ptr.h"
 #include "ns3/ipv4-list-routing.h"
+#include "ns3/internet-stack-helper.h"
 
 namespace ns3
 {
 
+static void
+DumpState (Ptr<carp::StateWriter> writer, Time interval, Time stop)
+{
+  writer->Snapshot ();
+  // Rescheduling for ever would keep a run without Simulator::Stop going
+  if (Simulator::Now () + interval <= stop)
+    {
+      Simulator::Schedule (interval, &DumpState, writer, interval, stop);
+    }
+}
+
 CarpHelper::CarpHelper() : 
   Ipv4RoutingHelper ()
 {
@@ -25,7 +39,11 @@ CarpHelper::Copy (void) const
 Ptr<Ipv4RoutingProtocol> 
 CarpHelper::Create (Ptr<Node> node) const
 {
-  Ptr<carp::RoutingProtocol> agent = m_agentFactory.Create<carp::RoutingProtocol> ();
+  if (m_prototype == 0)
+    {
+      m_prototype = m_agentFactory.Create<carp::RoutingProtocol> ();
+    }
+  Ptr<carp::RoutingProtocol> agent = CopyObject<carp::RoutingProtocol> (m_prototype);
   node->AggregateObject (agent);
   return agent;
 }
@@ -34,6 +52,23 @@ void
 CarpHelper::Set (std::string name, const AttributeValue &value)
 {
   m_agentFactory.Set (name, value);
+  m_prototype = 0;
+}
+
+void
+CarpHelper::Install (NodeContainer c) const
+{
+  InternetStackHelper stack;
+  stack.SetRoutingHelper (*this);
+  stack.Install (c);
+}
+
+NetDeviceContainer
+CarpHelper::InstallOverLinkChannel (NodeContainer c, Ptr<carp::LinkChannel> channel) const
+{
+  NetDeviceContainer devices = channel->Install (c);
+  Install (c);
+  return devices;
 }
 
 int64_t
@@ -76,4 +111,39 @@ CarpHelper::AssignStreams (NodeContainer c, int64_t stream)
   return (currentStream - stream);
 }
 
+double
+CarpHelper::GetBytesPerNode (NodeContainer c) const
+{
+  if (c.GetN () == 0)
+    {
+      return 0.0;
+    }
+  uint64_t bytes = 0;
+  for (NodeContainer::Iterator i = c.Begin (); i != c.End (); ++i)
+    {
+      Ptr<carp::RoutingProtocol> carp = (*i)->GetObject<carp::RoutingProtocol> ();
+      NS_ASSERT_MSG (carp, "CARP not installed on node " << (*i)->GetId ());
+      bytes += carp->GetMemoryUsage ();
+    }
+  return (double) bytes / c.GetN ();
+}
+
+void
+CarpHelper::DumpStateEvery (Time interval, std::string directory, NodeContainer c, Time stop) const
+{
+  Ptr<carp::StateWriter> writer = ns3::Create<carp::StateWriter> (directory);
+  for (NodeContainer::Iterator i = c.Begin (); i != c.End (); ++i)
+    {
+      Ptr<carp::RoutingProtocol> carp = (*i)->GetObject<carp::RoutingProtocol> ();
+      NS_ASSERT_MSG (carp, "CARP not installed on node " << (*i)->GetId ());
+      writer->Track ((*i)->GetId (), carp);
+    }
+  if (Simulator::Now () + interval <= stop)
+    {
+      Simulator::Schedule (interval, &DumpState, writer, interval, stop);
+    }
+  // Patch the row counts even if the run is stopped between two snapshots
+  Simulator::ScheduleDestroy (&carp::StateWriter::Close, writer);
+}
+
 }
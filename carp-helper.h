@@ -8,6 +8,10 @@
 #include "ns3/node.h"
 #include "ns3/node-container.h"
 #include "ns3/ipv4-routing-helper.h"
+#include "ns3/nstime.h"
+#include "ns3/net-device-container.h"
+#include "ns3/carp-routing-protocol.h"
+#include "ns3/carp-link-channel.h"
 #include <map>
 #include <set>
 
@@ -31,12 +35,46 @@ public:
 	
 	/* This method controls the attributes ns3::carp::RoutingProtocol*/
 	void Set (std::string name, const AttributeValue &value);
+
+	/*
+	* \param c, the nodes to install the internet stack with CARP on
+	* Bulk install for large fields: the CARP attributes are resolved once on a
+	* prototype agent that every node copies, and sockets are only created when
+	* the interfaces come up. Set ExpectedNeighbors to pre-size the neighbor tables.
+	*/
+	void Install (NodeContainer c) const;
+
+	/*
+	* \param c, the nodes to attach
+	* \param channel, the abstract link channel they share
+	* \returns the new devices, ready for address assignment
+	* Gives every node a carp::LinkNetDevice on channel and installs the internet
+	* stack with CARP as in Install, for routing-level studies without PHY cost
+	*/
+	NetDeviceContainer InstallOverLinkChannel (NodeContainer c, Ptr<carp::LinkChannel> channel) const;
+
+	/*
+	* \param c, nodes with CARP installed
+	* \returns the mean CARP state held per node, in bytes (see carp::RoutingProtocol::GetMemoryUsage)
+	*/
+	double GetBytesPerNode (NodeContainer c) const;
 	
 	/* return the number of stream indices assigned by this helper*/
 	int64_t AssignStreams (NodeContainer c, int64_t stream);
 
+	/*
+	* \param interval, time between two snapshots
+	* \param directory, where the column files of the dump are written
+	* \param c, the nodes whose CARP state is dumped
+	* \param stop, time of the last snapshot
+	* Appends the CARP state of every node in c to a columnar dump (see carp::StateWriter)
+	* every interval until stop; reading the state does not change it
+	*/
+	void DumpStateEvery (Time interval, std::string directory, NodeContainer c, Time stop) const;
+
 private:
 	ObjectFactory m_agentFactory; 
+	mutable Ptr<carp::RoutingProtocol> m_prototype; // Configured agent copied by Create, reset by Set
 };
 
 } //namespace ns3
@@ -0,0 +1,361 @@
+/* Abstract link-level channel for large CARP topologies */
+
+#include "carp-link-channel.h"
+#include "carp-link-net-device.h"
+#include "ns3/log.h"
+#include "ns3/node.h"
+#include "ns3/packet.h"
+#include "ns3/simulator.h"
+#include "ns3/mobility-model.h"
+#include "ns3/double.h"
+#include "ns3/enum.h"
+#include "ns3/uinteger.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("CarpLinkChannel");
+
+namespace carp {
+
+NS_OBJECT_ENSURE_REGISTERED (LinkChannel);
+
+TypeId
+LinkChannel::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::carp::LinkChannel")
+    .SetParent<Channel> ()
+    .SetGroupName ("Carp")
+    .AddConstructor<LinkChannel> ()
+    .AddAttribute ("Range", "Largest distance (m) a frame travels",
+                   DoubleValue (100.0),
+                   MakeDoubleAccessor (&LinkChannel::m_range),
+                   MakeDoubleChecker<double> (0.0))
+    .AddAttribute ("Model", "Success probability of a link in range: 1 (Disk) or falling linearly "
+                   "to EdgeQuality at Range (Linear)",
+                   EnumValue (LinkChannel::DISK),
+                   MakeEnumAccessor (&LinkChannel::m_model),
+                   MakeEnumChecker (LinkChannel::DISK, "Disk",
+                                    LinkChannel::LINEAR, "Linear"))
+    .AddAttribute ("EdgeQuality", "Success probability at Range in the linear model",
+                   DoubleValue (0.5),
+                   MakeDoubleAccessor (&LinkChannel::m_edgeQuality),
+                   MakeDoubleChecker<double> (0.0, 1.0))
+    .AddAttribute ("Delay", "Fixed part of the delay of every link",
+                   TimeValue (MicroSeconds (100)),
+                   MakeTimeAccessor (&LinkChannel::m_delay),
+                   MakeTimeChecker ())
+    .AddAttribute ("PropagationSpeed", "Speed (m/s) used for the distance dependent part of the delay, "
+                   "1500 for acoustic links",
+                   DoubleValue (3e8),
+                   MakeDoubleAccessor (&LinkChannel::m_speed),
+                   MakeDoubleChecker<double> (1.0))
+    .AddAttribute ("UnicastRetries", "Extra attempts for a unicast frame before its sender is told it failed",
+                   UintegerValue (0),
+                   MakeUintegerAccessor (&LinkChannel::m_unicastRetries),
+                   MakeUintegerChecker<uint32_t> ())
+  ;
+  return tid;
+}
+
+LinkChannel::LinkChannel ()
+  : m_gridValid (false),
+    m_tracked (0),
+    m_range (100.0),
+    m_model (DISK),
+    m_edgeQuality (0.5),
+    m_delay (MicroSeconds (100)),
+    m_speed (3e8),
+    m_unicastRetries (0)
+{
+  m_uniform = CreateObject<UniformRandomVariable> ();
+}
+
+void
+LinkChannel::Add (Ptr<LinkNetDevice> device)
+{
+  device->SetChannelId (m_devices.size ());
+  m_byAddress[Mac48Address::ConvertFrom (device->GetAddress ())] = m_devices.size ();
+  if (device->GetNode ())
+    {
+      m_byNode[device->GetNode ()->GetId ()] = m_devices.size ();
+    }
+  m_devices.push_back (device);
+  m_positions.push_back (Vector ());
+  m_gridValid = false;
+}
+
+NetDeviceContainer
+LinkChannel::Install (NodeContainer c)
+{
+  NetDeviceContainer devices;
+  for (NodeContainer::Iterator i = c.Begin (); i != c.End (); ++i)
+    {
+      Ptr<LinkNetDevice> device = CreateObject<LinkNetDevice> ();
+      device->SetAddress (Mac48Address::Allocate ());
+      (*i)->AddDevice (device);
+      device->SetChannel (this);
+      devices.Add (device);
+    }
+  return devices;
+}
+
+int64_t
+LinkChannel::AssignStreams (int64_t stream)
+{
+  m_uniform->SetStream (stream);
+  return 1;
+}
+
+std::size_t
+LinkChannel::GetNDevices (void) const
+{
+  return m_devices.size ();
+}
+
+Ptr<NetDevice>
+LinkChannel::GetDevice (std::size_t i) const
+{
+  return m_devices[i];
+}
+
+void
+LinkChannel::SetLinkQuality (Ptr<LinkNetDevice> a, Ptr<LinkNetDevice> b, double quality)
+{
+  m_linkQuality[std::make_pair (a->GetChannelId (), b->GetChannelId ())] = quality;
+}
+
+void
+LinkChannel::SetLinkDelay (Ptr<LinkNetDevice> a, Ptr<LinkNetDevice> b, Time delay)
+{
+  m_linkDelay[std::make_pair (a->GetChannelId (), b->GetChannelId ())] = delay;
+}
+
+double
+LinkChannel::GetLinkQuality (Ptr<LinkNetDevice> a, Ptr<LinkNetDevice> b)
+{
+  if (!m_gridValid)
+    {
+      BuildGrid ();
+    }
+  uint32_t i = a->GetChannelId ();
+  uint32_t j = b->GetChannelId ();
+  double distance = CalculateDistance (m_positions[i], m_positions[j]);
+  if (distance > m_range && !IsOverridden (i, j))
+    {
+      return 0.0;
+    }
+  return LinkQuality (i, j, distance);
+}
+
+void
+LinkChannel::ReplayTrace (std::string path)
+{
+  m_trace = Create<LinkTraceReader> (path, MakeCallback (&LinkChannel::SetTraceLink, this));
+  m_trace->Start ();
+}
+
+void
+LinkChannel::SetTraceLink (uint32_t fromNode, uint32_t toNode, double quality, Time delay)
+{
+  std::map<uint32_t, uint32_t>::const_iterator from = m_byNode.find (fromNode);
+  std::map<uint32_t, uint32_t>::const_iterator to = m_byNode.find (toNode);
+  if (from == m_byNode.end () || to == m_byNode.end ())
+    {
+      NS_LOG_DEBUG ("Link trace record for a node without a device on this channel: " << fromNode << "->" << toNode);
+      return;
+    }
+  std::pair<uint32_t, uint32_t> link (from->second, to->second);
+  m_linkQuality[link] = std::min (1.0, std::max (0.0, quality));
+  if (!delay.IsNegative ())
+    {
+      m_linkDelay[link] = delay;
+    }
+  else
+    {
+      m_linkDelay.erase (link); // Back to Delay and PropagationSpeed
+    }
+}
+
+LinkChannel::Cell
+LinkChannel::GetCell (const Vector &position) const
+{
+  double side = std::max (m_range, 1.0);
+  return Cell ((int32_t) std::floor (position.x / side), (int32_t) std::floor (position.y / side));
+}
+
+Vector
+LinkChannel::GetPosition (uint32_t id) const
+{
+  Ptr<Node> node = m_devices[id]->GetNode ();
+  Ptr<MobilityModel> mobility = node ? node->GetObject<MobilityModel> () : 0;
+  return mobility ? mobility->GetPosition () : Vector ();
+}
+
+// Mobility is usually installed after the devices, so the grid is built on the first frame
+void
+LinkChannel::BuildGrid ()
+{
+  m_grid.clear ();
+  for (uint32_t i = 0; i < m_devices.size (); ++i)
+    {
+      m_positions[i] = GetPosition (i);
+      m_grid[GetCell (m_positions[i])].push_back (i);
+    }
+  for (; m_tracked < m_devices.size (); ++m_tracked)
+    {
+      Ptr<Node> node = m_devices[m_tracked]->GetNode ();
+      Ptr<MobilityModel> mobility = node ? node->GetObject<MobilityModel> () : 0;
+      if (mobility)
+        {
+          std::ostringstream id;
+          id << m_tracked;
+          mobility->TraceConnect ("CourseChange", id.str (), MakeCallback (&LinkChannel::CourseChanged, this));
+        }
+    }
+  m_gridValid = true;
+}
+
+void
+LinkChannel::CourseChanged (std::string context, Ptr<const MobilityModel> mobility)
+{
+  if (!m_gridValid)
+    {
+      return; // The next BuildGrid reads every position anyway
+    }
+  uint32_t id = std::strtoul (context.c_str (), 0, 10);
+  Cell from = GetCell (m_positions[id]);
+  m_positions[id] = mobility->GetPosition ();
+  Cell to = GetCell (m_positions[id]);
+  if (from != to)
+    {
+      std::vector<uint32_t> &cell = m_grid[from];
+      cell.erase (std::find (cell.begin (), cell.end (), id));
+      m_grid[to].push_back (id);
+    }
+}
+
+double
+LinkChannel::LinkQuality (uint32_t a, uint32_t b, double distance) const
+{
+  std::map<std::pair<uint32_t, uint32_t>, double>::const_iterator it = m_linkQuality.find (std::make_pair (a, b));
+  if (it != m_linkQuality.end ())
+    {
+      return it->second;
+    }
+  if (m_model == LINEAR && m_range > 0)
+    {
+      return 1.0 - (1.0 - m_edgeQuality) * distance / m_range;
+    }
+  return 1.0;
+}
+
+bool
+LinkChannel::IsOverridden (uint32_t a, uint32_t b) const
+{
+  return m_linkQuality.find (std::make_pair (a, b)) != m_linkQuality.end ();
+}
+
+Time
+LinkChannel::LinkDelay (uint32_t a, uint32_t b, double distance) const
+{
+  std::map<std::pair<uint32_t, uint32_t>, Time>::const_iterator it = m_linkDelay.find (std::make_pair (a, b));
+  if (it != m_linkDelay.end ())
+    {
+      return it->second;
+    }
+  return m_delay + Seconds (distance / m_speed);
+}
+
+void
+LinkChannel::Send (Ptr<Packet> packet, uint16_t protocol, Mac48Address to, Mac48Address from,
+                   Ptr<LinkNetDevice> sender)
+{
+  NS_LOG_FUNCTION (this << packet << protocol << to << from << sender);
+  if (!m_gridValid)
+    {
+      BuildGrid ();
+    }
+  uint32_t s = sender->GetChannelId ();
+  if (!to.IsGroup ())
+    {
+      std::map<Mac48Address, uint32_t>::const_iterator it = m_byAddress.find (to);
+      double distance = 0.0;
+      bool delivered = false;
+      if (it != m_byAddress.end ())
+        {
+          distance = CalculateDistance (m_positions[s], m_positions[it->second]);
+          if (distance <= m_range || IsOverridden (s, it->second))
+            {
+              double quality = LinkQuality (s, it->second, distance);
+              for (uint32_t attempt = 0; attempt <= m_unicastRetries && !delivered; ++attempt)
+                {
+                  delivered = m_uniform->GetValue () < quality;
+                }
+            }
+        }
+      if (delivered)
+        {
+          Deliver (packet, protocol, to, from, s, it->second, distance);
+        }
+      else
+        {
+          Simulator::Schedule (m_delay, &LinkNetDevice::NotifyTxFailed, sender, to);
+        }
+      return;
+    }
+
+  // Broadcast: only the cells around the sender can hold devices in range
+  Cell center = GetCell (m_positions[s]);
+  for (int32_t dx = -1; dx <= 1; ++dx)
+    {
+      for (int32_t dy = -1; dy <= 1; ++dy)
+        {
+          std::map<Cell, std::vector<uint32_t> >::const_iterator cell =
+            m_grid.find (Cell (center.first + dx, center.second + dy));
+          if (cell == m_grid.end ())
+            {
+              continue;
+            }
+          for (std::vector<uint32_t>::const_iterator r = cell->second.begin (); r != cell->second.end (); ++r)
+            {
+              if (*r == s || IsOverridden (s, *r))
+                {
+                  continue; // Links set explicitly are handled below, in or out of range
+                }
+              double distance = CalculateDistance (m_positions[s], m_positions[*r]);
+              if (distance <= m_range && m_uniform->GetValue () < LinkQuality (s, *r, distance))
+                {
+                  Deliver (packet, protocol, to, from, s, *r, distance);
+                }
+            }
+        }
+    }
+  std::map<std::pair<uint32_t, uint32_t>, double>::const_iterator link =
+    m_linkQuality.lower_bound (std::make_pair (s, 0u));
+  for (; link != m_linkQuality.end () && link->first.first == s; ++link)
+    {
+      if (link->second > 0 && m_uniform->GetValue () < link->second)
+        {
+          uint32_t r = link->first.second;
+          Deliver (packet, protocol, to, from, s, r, CalculateDistance (m_positions[s], m_positions[r]));
+        }
+    }
+}
+
+void
+LinkChannel::Deliver (Ptr<Packet> packet, uint16_t protocol, Mac48Address to, Mac48Address from,
+                      uint32_t sender, uint32_t receiver, double distance)
+{
+  Ptr<LinkNetDevice> device = m_devices[receiver];
+  uint32_t context = device->GetNode () ? device->GetNode ()->GetId () : Simulator::NO_CONTEXT;
+  Simulator::ScheduleWithContext (context, LinkDelay (sender, receiver, distance), &LinkNetDevice::Receive,
+                                  device, packet->Copy (), protocol, to, from,
+                                  LinkQuality (sender, receiver, distance));
+}
+
+} // namespace carp
+} // namespace ns3
@@ -0,0 +1,115 @@
+/* Abstract link-level channel for large CARP topologies */
+
+#ifndef CARP_LINK_CHANNEL_H
+#define CARP_LINK_CHANNEL_H
+
+#include <map>
+#include <vector>
+#include <string>
+#include "ns3/channel.h"
+#include "ns3/mac48-address.h"
+#include "ns3/node-container.h"
+#include "ns3/net-device-container.h"
+#include "ns3/nstime.h"
+#include "ns3/vector.h"
+#include "ns3/random-variable-stream.h"
+#include "ns3/carp-link-trace.h"
+
+namespace ns3 {
+
+class MobilityModel;
+class Packet;
+
+namespace carp {
+
+class LinkNetDevice;
+
+/*
+ * Routing-level channel without PHY processing. A frame reaches every device
+ * within Range of the sender, found through a spatial grid of Range sized
+ * cells, and each copy is delivered with the success probability of its link:
+ * 1 in the disk model, falling linearly to EdgeQuality at Range in the linear
+ * model, or a value set per link. The delay is Delay plus the propagation time
+ * at PropagationSpeed, or a value set per link. A link with a value set is
+ * used whatever the distance, so recorded deployments can be replayed with
+ * ReplayTrace and Range set to 0. Devices must have their address and node
+ * set before they are added.
+ */
+class LinkChannel : public Channel
+{
+public:
+  enum LinkModel
+  {
+    DISK,
+    LINEAR
+  };
+
+  static TypeId GetTypeId (void);
+  LinkChannel ();
+
+  /// Attach device, whose address must already be set
+  void Add (Ptr<LinkNetDevice> device);
+  /// Give every node of c a new LinkNetDevice on this channel, with a fresh MAC address
+  NetDeviceContainer Install (NodeContainer c);
+  /// Deliver packet from sender to the devices in range, or only to the device with address to for unicast
+  void Send (Ptr<Packet> packet, uint16_t protocol, Mac48Address to, Mac48Address from,
+             Ptr<LinkNetDevice> sender);
+
+  /// Override the success probability of the link from a to b
+  void SetLinkQuality (Ptr<LinkNetDevice> a, Ptr<LinkNetDevice> b, double quality);
+  /// Override the delay of the link from a to b
+  void SetLinkDelay (Ptr<LinkNetDevice> a, Ptr<LinkNetDevice> b, Time delay);
+  /// \returns the success probability of the link from a to b, 0 if out of range
+  double GetLinkQuality (Ptr<LinkNetDevice> a, Ptr<LinkNetDevice> b);
+  /// Drive the per-link quality and delay from a recorded trace (see LinkTraceReader), streamed as the simulation runs
+  void ReplayTrace (std::string path);
+
+  /**
+   * Assign a fixed random variable stream number to the random variables
+   * used by this model.  Return the number of streams (possibly zero) that
+   * have been assigned.
+   */
+  int64_t AssignStreams (int64_t stream);
+
+  // Methods inherited from Channel
+  virtual std::size_t GetNDevices (void) const;
+  virtual Ptr<NetDevice> GetDevice (std::size_t i) const;
+
+private:
+  typedef std::pair<int32_t, int32_t> Cell;
+
+  Cell GetCell (const Vector &position) const;
+  Vector GetPosition (uint32_t id) const;
+  void BuildGrid (); // Place every device in its cell and follow mobility from then on
+  void CourseChanged (std::string context, Ptr<const MobilityModel> mobility);
+  double LinkQuality (uint32_t a, uint32_t b, double distance) const;
+  bool IsOverridden (uint32_t a, uint32_t b) const;
+  void SetTraceLink (uint32_t fromNode, uint32_t toNode, double quality, Time delay);
+  Time LinkDelay (uint32_t a, uint32_t b, double distance) const;
+  void Deliver (Ptr<Packet> packet, uint16_t protocol, Mac48Address to, Mac48Address from,
+                uint32_t sender, uint32_t receiver, double distance);
+
+  std::vector<Ptr<LinkNetDevice> > m_devices; // Indexed by the channel ID of the device
+  std::map<Mac48Address, uint32_t> m_byAddress;
+  std::map<uint32_t, uint32_t> m_byNode; // Node ID to channel ID
+  std::vector<Vector> m_positions; // Last known position of each device
+  std::map<Cell, std::vector<uint32_t> > m_grid;
+  bool m_gridValid;
+  uint32_t m_tracked; // Devices whose mobility model is followed
+  std::map<std::pair<uint32_t, uint32_t>, double> m_linkQuality; // Per link overrides, ordered by sender
+  std::map<std::pair<uint32_t, uint32_t>, Time> m_linkDelay;
+
+  double m_range; // Largest distance (m) a frame travels
+  LinkModel m_model;
+  double m_edgeQuality; // Success probability at m_range in the linear model
+  Time m_delay; // Fixed part of the link delay
+  double m_speed; // Propagation speed (m/s)
+  uint32_t m_unicastRetries; // Extra attempts for a unicast frame before the sender is told it failed
+  Ptr<UniformRandomVariable> m_uniform;
+  Ptr<LinkTraceReader> m_trace;
+};
+
+} // namespace carp
+} // namespace ns3
+
+#endif /* CARP_LINK_CHANNEL_H */
@@ -0,0 +1,264 @@
+/* Net device of the abstract CARP link channel */
+
+#include "carp-link-net-device.h"
+#include "carp-link-channel.h"
+#include "ns3/log.h"
+#include "ns3/node.h"
+#include "ns3/packet.h"
+#include "ns3/uinteger.h"
+#include "ns3/pointer.h"
+#include "ns3/trace-source-accessor.h"
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("CarpLinkNetDevice");
+
+namespace carp {
+
+NS_OBJECT_ENSURE_REGISTERED (LinkNetDevice);
+
+TypeId
+LinkNetDevice::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::carp::LinkNetDevice")
+    .SetParent<NetDevice> ()
+    .SetGroupName ("Carp")
+    .AddConstructor<LinkNetDevice> ()
+    .AddAttribute ("Mtu", "The MAC-level Maximum Transmission Unit",
+                   UintegerValue (1500),
+                   MakeUintegerAccessor (&LinkNetDevice::SetMtu,
+                                         &LinkNetDevice::GetMtu),
+                   MakeUintegerChecker<uint16_t> ())
+    .AddAttribute ("Channel", "The channel attached to this device",
+                   PointerValue (),
+                   MakePointerAccessor (&LinkNetDevice::m_channel),
+                   MakePointerChecker<LinkChannel> ())
+    .AddTraceSource ("RxOk", "A frame was received, with the quality of the link it arrived on",
+                     MakeTraceSourceAccessor (&LinkNetDevice::m_rxOkTrace),
+                     "ns3::carp::LinkNetDevice::RxOkTracedCallback")
+    .AddTraceSource ("Tx", "A frame was handed to the channel, with its protocol number",
+                     MakeTraceSourceAccessor (&LinkNetDevice::m_txTrace),
+                     "ns3::carp::LinkNetDevice::TxTracedCallback")
+    .AddTraceSource ("TxFailed", "A unicast frame could not be delivered to its destination",
+                     MakeTraceSourceAccessor (&LinkNetDevice::m_txFailedTrace),
+                     "ns3::Mac48Address::TracedCallback")
+  ;
+  return tid;
+}
+
+LinkNetDevice::LinkNetDevice ()
+  : m_ifIndex (0),
+    m_channelId (0),
+    m_mtu (1500)
+{
+}
+
+void
+LinkNetDevice::SetChannel (Ptr<LinkChannel> channel)
+{
+  m_channel = channel;
+  m_channel->Add (this);
+}
+
+void
+LinkNetDevice::Receive (Ptr<Packet> packet, uint16_t protocol, Mac48Address to, Mac48Address from, double quality)
+{
+  NS_LOG_FUNCTION (this << packet << protocol << to << from << quality);
+  m_rxOkTrace (packet, from, quality);
+  NetDevice::PacketType packetType;
+  if (to == m_address)
+    {
+      packetType = NetDevice::PACKET_HOST;
+    }
+  else if (to.IsBroadcast ())
+    {
+      packetType = NetDevice::PACKET_BROADCAST;
+    }
+  else if (to.IsGroup ())
+    {
+      packetType = NetDevice::PACKET_MULTICAST;
+    }
+  else
+    {
+      packetType = NetDevice::PACKET_OTHERHOST;
+    }
+  if (!m_promiscCallback.IsNull ())
+    {
+      m_promiscCallback (this, packet, protocol, from, to, packetType);
+    }
+  if (packetType != NetDevice::PACKET_OTHERHOST)
+    {
+      m_rxCallback (this, packet, protocol, from);
+    }
+}
+
+void
+LinkNetDevice::NotifyTxFailed (Mac48Address to)
+{
+  m_txFailedTrace (to);
+}
+
+void
+LinkNetDevice::SetIfIndex (const uint32_t index)
+{
+  m_ifIndex = index;
+}
+
+uint32_t
+LinkNetDevice::GetIfIndex (void) const
+{
+  return m_ifIndex;
+}
+
+Ptr<Channel>
+LinkNetDevice::GetChannel (void) const
+{
+  return m_channel;
+}
+
+void
+LinkNetDevice::SetAddress (Address address)
+{
+  m_address = Mac48Address::ConvertFrom (address);
+}
+
+Address
+LinkNetDevice::GetAddress (void) const
+{
+  return m_address;
+}
+
+bool
+LinkNetDevice::SetMtu (const uint16_t mtu)
+{
+  m_mtu = mtu;
+  return true;
+}
+
+uint16_t
+LinkNetDevice::GetMtu (void) const
+{
+  return m_mtu;
+}
+
+bool
+LinkNetDevice::IsLinkUp (void) const
+{
+  return true;
+}
+
+void
+LinkNetDevice::AddLinkChangeCallback (Callback<void> callback)
+{
+}
+
+bool
+LinkNetDevice::IsBroadcast (void) const
+{
+  return true;
+}
+
+Address
+LinkNetDevice::GetBroadcast (void) const
+{
+  return Mac48Address ("ff:ff:ff:ff:ff:ff");
+}
+
+bool
+LinkNetDevice::IsMulticast (void) const
+{
+  return false;
+}
+
+Address
+LinkNetDevice::GetMulticast (Ipv4Address multicastGroup) const
+{
+  return Mac48Address::GetMulticast (multicastGroup);
+}
+
+Address
+LinkNetDevice::GetMulticast (Ipv6Address addr) const
+{
+  return Mac48Address::GetMulticast (addr);
+}
+
+bool
+LinkNetDevice::IsPointToPoint (void) const
+{
+  return false;
+}
+
+bool
+LinkNetDevice::IsBridge (void) const
+{
+  return false;
+}
+
+bool
+LinkNetDevice::Send (Ptr<Packet> packet, const Address& dest, uint16_t protocolNumber)
+{
+  return SendFrom (packet, m_address, dest, protocolNumber);
+}
+
+bool
+LinkNetDevice::SendFrom (Ptr<Packet> packet, const Address& source, const Address& dest, uint16_t protocolNumber)
+{
+  NS_LOG_FUNCTION (this << packet << source << dest << protocolNumber);
+  if (packet->GetSize () > m_mtu || m_channel == 0)
+    {
+      return false;
+    }
+  m_txTrace (packet, protocolNumber);
+  m_channel->Send (packet, protocolNumber, Mac48Address::ConvertFrom (dest),
+                   Mac48Address::ConvertFrom (source), this);
+  return true;
+}
+
+Ptr<Node>
+LinkNetDevice::GetNode (void) const
+{
+  return m_node;
+}
+
+void
+LinkNetDevice::SetNode (Ptr<Node> node)
+{
+  m_node = node;
+}
+
+bool
+LinkNetDevice::NeedsArp (void) const
+{
+  return true;
+}
+
+void
+LinkNetDevice::SetReceiveCallback (NetDevice::ReceiveCallback cb)
+{
+  m_rxCallback = cb;
+}
+
+void
+LinkNetDevice::SetPromiscReceiveCallback (PromiscReceiveCallback cb)
+{
+  m_promiscCallback = cb;
+}
+
+bool
+LinkNetDevice::SupportsSendFrom (void) const
+{
+  return true;
+}
+
+void
+LinkNetDevice::DoDispose (void)
+{
+  m_channel = 0;
+  m_node = 0;
+  m_rxCallback.Nullify ();
+  m_promiscCallback.Nullify ();
+  NetDevice::DoDispose ();
+}
+
+} // namespace carp
+} // namespace ns3
@@ -0,0 +1,104 @@
+/* Net device of the abstract CARP link channel */
+
+#ifndef CARP_LINK_NET_DEVICE_H
+#define CARP_LINK_NET_DEVICE_H
+
+#include "ns3/net-device.h"
+#include "ns3/mac48-address.h"
+#include "ns3/traced-callback.h"
+
+namespace ns3 {
+
+class Node;
+
+namespace carp {
+
+class LinkChannel;
+
+/*
+ * Frames are handed to the LinkChannel as they are: no MAC header, no
+ * queueing and no per-bit PHY. The channel reports the quality of every link
+ * a frame arrives on through the RxOk trace, and unicast frames it could not
+ * deliver through TxFailed, which stand in for the PHY and MAC traces CARP
+ * reads on Wifi devices.
+ */
+class LinkNetDevice : public NetDevice
+{
+public:
+  /**
+   * TracedCallback signature for received frames.
+   *
+   * \param [in] packet The frame.
+   * \param [in] from Sender address.
+   * \param [in] quality Success probability of the link it arrived on.
+   */
+  typedef void (* RxOkTracedCallback)(Ptr<const Packet> packet, Mac48Address from, double quality);
+
+  /**
+   * TracedCallback signature for frames handed to the channel.
+   *
+   * \param [in] packet The frame.
+   * \param [in] protocol Its protocol number (EtherType).
+   */
+  typedef void (* TxTracedCallback)(Ptr<const Packet> packet, uint16_t protocol);
+
+  static TypeId GetTypeId (void);
+  LinkNetDevice ();
+
+  void SetChannel (Ptr<LinkChannel> channel);
+  /// Position of this device in the channel tables, set by LinkChannel::Add
+  void SetChannelId (uint32_t id) { m_channelId = id; }
+  uint32_t GetChannelId () const { return m_channelId; }
+
+  /// A frame from a neighbor reached this device
+  void Receive (Ptr<Packet> packet, uint16_t protocol, Mac48Address to, Mac48Address from, double quality);
+  /// The channel could not deliver a unicast frame to to
+  void NotifyTxFailed (Mac48Address to);
+
+  // Methods inherited from NetDevice
+  virtual void SetIfIndex (const uint32_t index);
+  virtual uint32_t GetIfIndex (void) const;
+  virtual Ptr<Channel> GetChannel (void) const;
+  virtual void SetAddress (Address address);
+  virtual Address GetAddress (void) const;
+  virtual bool SetMtu (const uint16_t mtu);
+  virtual uint16_t GetMtu (void) const;
+  virtual bool IsLinkUp (void) const;
+  virtual void AddLinkChangeCallback (Callback<void> callback);
+  virtual bool IsBroadcast (void) const;
+  virtual Address GetBroadcast (void) const;
+  virtual bool IsMulticast (void) const;
+  virtual Address GetMulticast (Ipv4Address multicastGroup) const;
+  virtual Address GetMulticast (Ipv6Address addr) const;
+  virtual bool IsPointToPoint (void) const;
+  virtual bool IsBridge (void) const;
+  virtual bool Send (Ptr<Packet> packet, const Address& dest, uint16_t protocolNumber);
+  virtual bool SendFrom (Ptr<Packet> packet, const Address& source, const Address& dest, uint16_t protocolNumber);
+  virtual Ptr<Node> GetNode (void) const;
+  virtual void SetNode (Ptr<Node> node);
+  virtual bool NeedsArp (void) const;
+  virtual void SetReceiveCallback (NetDevice::ReceiveCallback cb);
+  virtual void SetPromiscReceiveCallback (PromiscReceiveCallback cb);
+  virtual bool SupportsSendFrom (void) const;
+
+protected:
+  virtual void DoDispose (void);
+
+private:
+  Ptr<LinkChannel> m_channel;
+  Ptr<Node> m_node;
+  Mac48Address m_address;
+  uint32_t m_ifIndex;
+  uint32_t m_channelId;
+  uint16_t m_mtu;
+  NetDevice::ReceiveCallback m_rxCallback;
+  NetDevice::PromiscReceiveCallback m_promiscCallback;
+  TracedCallback<Ptr<const Packet>, Mac48Address, double> m_rxOkTrace;
+  TracedCallback<Ptr<const Packet>, uint16_t> m_txTrace;
+  TracedCallback<Mac48Address> m_txFailedTrace;
+};
+
+} // namespace carp
+} // namespace ns3
+
+#endif /* CARP_LINK_NET_DEVICE_H */
@@ -0,0 +1,87 @@
+/* Replay of recorded link measurements on the abstract CARP link channel */
+
+#include "carp-link-trace.h"
+#include "ns3/log.h"
+#include "ns3/abort.h"
+#include "ns3/simulator.h"
+#include <sstream>
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("CarpLinkTrace");
+
+namespace carp {
+
+LinkTraceReader::LinkTraceReader (std::string path, LinkCallback cb)
+  : m_path (path),
+    m_in (path.c_str ()),
+    m_cb (cb),
+    m_line (0),
+    m_records (0),
+    m_nextFrom (0),
+    m_nextTo (0),
+    m_nextQuality (0.0)
+{
+  NS_ABORT_MSG_UNLESS (m_in.is_open (), "Cannot open link trace " << path);
+}
+
+void
+LinkTraceReader::Start ()
+{
+  if (ReadNext ())
+    {
+      Simulator::Schedule (Max (m_nextTime - Simulator::Now (), Seconds (0)), &LinkTraceReader::Apply,
+                           Ptr<LinkTraceReader> (this));
+    }
+}
+
+bool
+LinkTraceReader::ReadNext ()
+{
+  std::string line;
+  while (std::getline (m_in, line))
+    {
+      m_line++;
+      std::string::size_type comment = line.find ('#');
+      if (comment != std::string::npos)
+        {
+          line.erase (comment);
+        }
+      std::istringstream fields (line);
+      double time;
+      if (!(fields >> time))
+        {
+          continue; // Blank or comment line
+        }
+      double delay = -1.0;
+      NS_ABORT_MSG_UNLESS (fields >> m_nextFrom >> m_nextTo >> m_nextQuality,
+                           m_path << ":" << m_line << ": malformed link record");
+      fields >> delay;
+      Time t = Seconds (time);
+      NS_ABORT_MSG_IF (t < m_nextTime, m_path << ":" << m_line << ": records out of time order");
+      m_nextTime = t;
+      m_nextDelay = Seconds (delay);
+      return true;
+    }
+  return false;
+}
+
+void
+LinkTraceReader::Apply ()
+{
+  do
+    {
+      m_cb (m_nextFrom, m_nextTo, m_nextQuality, m_nextDelay);
+      m_records++;
+      if (!ReadNext ())
+        {
+          NS_LOG_INFO ("Link trace " << m_path << " done after " << m_records << " records");
+          return;
+        }
+    }
+  while (m_nextTime <= Simulator::Now ());
+  Simulator::Schedule (m_nextTime - Simulator::Now (), &LinkTraceReader::Apply, Ptr<LinkTraceReader> (this));
+}
+
+} // namespace carp
+} // namespace ns3
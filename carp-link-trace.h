@@ -0,0 +1,57 @@
+/* Replay of recorded link measurements on the abstract CARP link channel */
+
+#ifndef CARP_LINK_TRACE_H
+#define CARP_LINK_TRACE_H
+
+#include <fstream>
+#include <string>
+#include "ns3/simple-ref-count.h"
+#include "ns3/callback.h"
+#include "ns3/nstime.h"
+
+namespace ns3 {
+namespace carp {
+
+/*
+ * Streams a link measurement trace and hands every record to a callback at
+ * its simulation time. Only the next record is held in memory, so traces of
+ * any size can be replayed. The file is text, one record per line:
+ *
+ *   <time_s> <from_node> <to_node> <quality> [<delay_s>]
+ *
+ * with records in non-decreasing time order, nodes given by their ns-3 node
+ * ID, quality the frame success probability in [0,1] and '#' starting a
+ * comment. A negative delay, or none, keeps the channel's delay model.
+ */
+class LinkTraceReader : public SimpleRefCount<LinkTraceReader>
+{
+public:
+  /// Link from, link to, quality, delay (negative if not recorded)
+  typedef Callback<void, uint32_t, uint32_t, double, Time> LinkCallback;
+
+  LinkTraceReader (std::string path, LinkCallback cb);
+  /// Schedule the first record; later ones are read as the simulation reaches them
+  void Start ();
+  /// Records applied so far
+  uint64_t GetRecords () const { return m_records; }
+
+private:
+  bool ReadNext (); // Parse the next record into m_next*, false at the end of the file
+  void Apply (); // Apply every record due now and schedule the next one
+
+  std::string m_path;
+  std::ifstream m_in;
+  LinkCallback m_cb;
+  uint64_t m_line; // Line number of the record held, for error messages
+  uint64_t m_records;
+  Time m_nextTime;
+  uint32_t m_nextFrom;
+  uint32_t m_nextTo;
+  double m_nextQuality;
+  Time m_nextDelay;
+};
+
+} // namespace carp
+} // namespace ns3
+
+#endif /* CARP_LINK_TRACE_H */
@@ -0,0 +1,219 @@
+/* Buffer for packets waiting on a PING/PONG handshake of the Channel-aware Routing Protocol */
+
+#include "carp-packet-queue.h"
+#include "ns3/log.h"
+#include "ns3/packet.h"
+#include "ns3/socket.h"
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("CarpPacketQueue");
+
+namespace carp {
+
+NS_OBJECT_ENSURE_REGISTERED (PriorityTag);
+
+TypeId
+PriorityTag::GetTypeId ()
+{
+  static TypeId tid = TypeId ("ns3::carp::PriorityTag")
+    .SetParent<Tag> ()
+    .SetGroupName ("Carp")
+    .AddConstructor<PriorityTag> ()
+  ;
+  return tid;
+}
+
+TypeId
+PriorityTag::GetInstanceTypeId () const
+{
+  return GetTypeId ();
+}
+
+uint32_t
+PriorityTag::GetSerializedSize () const
+{
+  return 1;
+}
+
+void
+PriorityTag::Serialize (TagBuffer i) const
+{
+  i.WriteU8 (m_class);
+}
+
+void
+PriorityTag::Deserialize (TagBuffer i)
+{
+  uint8_t c = i.ReadU8 ();
+  m_class = (c < CLASS_COUNT) ? (TrafficClass) c : CLASS_ROUTINE;
+}
+
+void
+PriorityTag::Print (std::ostream &os) const
+{
+  os << "PriorityTag: class = " << (uint32_t) m_class;
+}
+
+TrafficClass
+PriorityTag::Classify (Ptr<const Packet> p, const Ipv4Header & header)
+{
+  PriorityTag tag;
+  if (p->PeekPacketTag (tag))
+    {
+      return tag.Get ();
+    }
+  Ipv4Header::DscpType dscp = header.GetDscp ();
+  SocketIpTosTag tos;
+  if (p->PeekPacketTag (tos))
+    {
+      // Socket TOS only reaches the header in Ipv4L3Protocol::Send, after RouteOutput
+      dscp = Ipv4Header::DscpType (tos.GetTos () >> 2);
+    }
+  if (dscp == Ipv4Header::DSCP_EF || dscp >= Ipv4Header::DSCP_CS5)
+    {
+      return CLASS_URGENT;
+    }
+  return CLASS_ROUTINE;
+}
+
+uint32_t
+PacketQueue::GetSize ()
+{
+  Purge ();
+  return m_size;
+}
+
+uint32_t
+PacketQueue::GetMemoryUsage () const
+{
+  // A red-black tree node carries three pointers and a colour next to its value
+  uint32_t bytes = m_queue.size () * (4 * sizeof (void *) + sizeof (std::pair<const Ipv4Address, std::vector<QueueEntry> >));
+  for (std::map<Ipv4Address, std::vector<QueueEntry> >::const_iterator i = m_queue.begin ();
+       i != m_queue.end (); ++i)
+    {
+      bytes += i->second.capacity () * sizeof (QueueEntry);
+      for (std::vector<QueueEntry>::const_iterator j = i->second.begin (); j != i->second.end (); ++j)
+        {
+          bytes += sizeof (Packet) + j->GetPacket ()->GetSize ();
+        }
+    }
+  return bytes;
+}
+
+bool
+PacketQueue::Enqueue (QueueEntry & entry)
+{
+  Purge ();
+  std::vector<QueueEntry> &queue = m_queue[entry.GetIpv4Header ().GetDestination ()];
+  if (queue.size () >= m_maxLenPerDst && !queue.empty ())
+    {
+      m_overflowDrops++;
+      // The lowest class present sits at the back; its oldest packet opens that block
+      TrafficClass lowest = queue.back ().GetTrafficClass ();
+      if (entry.GetTrafficClass () < lowest)
+        {
+          Drop (entry, "Drop the new lower class packet");
+          return false;
+        }
+      std::vector<QueueEntry>::iterator victim = queue.begin ();
+      while (victim->GetTrafficClass () != lowest)
+        {
+          ++victim;
+        }
+      Drop (*victim, "Drop the most aged packet");
+      queue.erase (victim);
+      m_size--;
+    }
+  entry.SetExpireTime (m_queueTimeout);
+  std::vector<QueueEntry>::iterator pos = queue.begin ();
+  while (pos != queue.end () && pos->GetTrafficClass () >= entry.GetTrafficClass ())
+    {
+      ++pos;
+    }
+  queue.insert (pos, entry);
+  m_size++;
+  return true;
+}
+
+std::vector<QueueEntry>
+PacketQueue::DequeueAll (Ipv4Address dst)
+{
+  Purge ();
+  std::vector<QueueEntry> batch;
+  std::map<Ipv4Address, std::vector<QueueEntry> >::iterator i = m_queue.find (dst);
+  if (i == m_queue.end ())
+    {
+      return batch;
+    }
+  batch.swap (i->second);
+  m_size -= batch.size ();
+  m_queue.erase (i);
+  return batch;
+}
+
+bool
+PacketQueue::Find (Ipv4Address dst)
+{
+  Purge ();
+  return m_queue.find (dst) != m_queue.end ();
+}
+
+std::vector<Ipv4Address>
+PacketQueue::GetDestinations ()
+{
+  Purge ();
+  std::vector<Ipv4Address> dsts;
+  for (std::map<Ipv4Address, std::vector<QueueEntry> >::const_iterator i = m_queue.begin ();
+       i != m_queue.end (); ++i)
+    {
+      dsts.push_back (i->first);
+    }
+  return dsts;
+}
+
+void
+PacketQueue::Purge ()
+{
+  std::map<Ipv4Address, std::vector<QueueEntry> >::iterator i = m_queue.begin ();
+  while (i != m_queue.end ())
+    {
+      // Classes interleave arrival order, so every entry is checked
+      std::vector<QueueEntry>::iterator keep = i->second.begin ();
+      for (std::vector<QueueEntry>::iterator j = i->second.begin (); j != i->second.end (); ++j)
+        {
+          if (j->GetExpireTime () < Seconds (0))
+            {
+              m_timeoutDrops++;
+              m_size--;
+              Drop (*j, "Drop outdated packet ");
+            }
+          else
+            {
+              *keep++ = *j;
+            }
+        }
+      i->second.erase (keep, i->second.end ());
+      if (i->second.empty ())
+        {
+          m_queue.erase (i++);
+        }
+      else
+        {
+          ++i;
+        }
+    }
+}
+
+void
+PacketQueue::Drop (QueueEntry en, std::string reason)
+{
+  NS_LOG_LOGIC (reason << en.GetPacket ()->GetUid () << " " << en.GetIpv4Header ().GetDestination ());
+  if (!m_drop.IsNull ())
+    {
+      m_drop (en.GetPacket (), en.GetIpv4Header ());
+    }
+}
+
+} // namespace carp
+} // namespace ns3
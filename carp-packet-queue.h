@@ -0,0 +1,152 @@
+/* Buffer for packets waiting on a PING/PONG handshake of the Channel-aware Routing Protocol */
+
+#ifndef CARP_PACKET_QUEUE_H
+#define CARP_PACKET_QUEUE_H
+
+#include <vector>
+#include <map>
+#include "ns3/ipv4-routing-protocol.h"
+#include "ns3/simulator.h"
+#include "ns3/tag.h"
+
+namespace ns3 {
+namespace carp {
+
+/// Traffic classes, in increasing priority
+enum TrafficClass
+{
+  CLASS_ROUTINE = 0,
+  CLASS_URGENT = 1,
+  CLASS_COUNT = 2
+};
+
+/*
+ * Marks a packet with its CARP traffic class. Without the tag, packets with an
+ * EF or CS5 and above DSCP are urgent and everything else is routine.
+ */
+class PriorityTag : public Tag
+{
+public:
+  PriorityTag (TrafficClass c = CLASS_ROUTINE) : m_class (c) {}
+
+  static TypeId GetTypeId ();
+  TypeId GetInstanceTypeId () const;
+  uint32_t GetSerializedSize () const;
+  void Serialize (TagBuffer i) const;
+  void Deserialize (TagBuffer i);
+  void Print (std::ostream &os) const;
+
+  TrafficClass Get () const { return m_class; }
+  void Set (TrafficClass c) { m_class = c; }
+
+  /// Class of a packet, from its tag or else its DSCP, taken from the socket TOS tag if present
+  static TrafficClass Classify (Ptr<const Packet> p, const Ipv4Header & header);
+
+private:
+  TrafficClass m_class;
+};
+
+/* A packet held while its relay is being chosen, with the callbacks needed to send it later */
+class QueueEntry
+{
+public:
+  typedef Ipv4RoutingProtocol::UnicastForwardCallback UnicastForwardCallback;
+  typedef Ipv4RoutingProtocol::ErrorCallback ErrorCallback;
+
+  QueueEntry (Ptr<const Packet> pa = 0, Ipv4Header const & h = Ipv4Header (),
+              UnicastForwardCallback ucb = UnicastForwardCallback (),
+              ErrorCallback ecb = ErrorCallback (), Time exp = Simulator::Now ())
+    : m_packet (pa),
+      m_header (h),
+      m_ucb (ucb),
+      m_ecb (ecb),
+      m_expire (exp + Simulator::Now ()),
+      m_arrival (Simulator::Now ()),
+      m_class (CLASS_ROUTINE)
+  {
+  }
+
+  Ptr<const Packet> GetPacket () const { return m_packet; }
+  Ipv4Header GetIpv4Header () const { return m_header; }
+  UnicastForwardCallback GetUnicastForwardCallback () const { return m_ucb; }
+  ErrorCallback GetErrorCallback () const { return m_ecb; }
+  void SetExpireTime (Time exp) { m_expire = exp + Simulator::Now (); }
+  Time GetExpireTime () const { return m_expire - Simulator::Now (); }
+  /// Time spent in the queue so far
+  Time GetHoldTime () const { return Simulator::Now () - m_arrival; }
+  void SetTrafficClass (TrafficClass c) { m_class = c; }
+  TrafficClass GetTrafficClass () const { return m_class; }
+
+private:
+  Ptr<const Packet> m_packet; // Data packet
+  Ipv4Header m_header; // IP header
+  UnicastForwardCallback m_ucb; // Unicast forward callback
+  ErrorCallback m_ecb; // Error callback
+  Time m_expire; // Expire time for queue entry
+  Time m_arrival; // Time the entry was created
+  TrafficClass m_class;
+};
+
+/*
+ * Per-destination queue of packets deferred during a handshake, urgent
+ * packets ahead of routine ones and FIFO within a class. Each destination
+ * holds at most maxLenPerDst packets; on overflow the oldest packet of the
+ * lowest class present makes room, unless the new one is of a lower class
+ * still. Packets older than the queue timeout are dropped on every access.
+ * Drops are counted and reported through the drop callback.
+ */
+class PacketQueue
+{
+public:
+  typedef Callback<void, Ptr<const Packet>, const Ipv4Header &> DropCallback;
+
+  PacketQueue (uint32_t maxLenPerDst, Time queueTimeout)
+    : m_maxLenPerDst (maxLenPerDst),
+      m_queueTimeout (queueTimeout),
+      m_size (0),
+      m_timeoutDrops (0),
+      m_overflowDrops (0)
+  {
+  }
+
+  /// Push entry in queue by class, dropping a packet to the same destination if full; false if entry itself is dropped
+  bool Enqueue (QueueEntry & entry);
+  /// Remove and return every packet to dst, urgent first, so they can be released as one batch
+  std::vector<QueueEntry> DequeueAll (Ipv4Address dst);
+  /// Finds whether a packet with destination dst exists in the queue
+  bool Find (Ipv4Address dst);
+  /// Destinations that currently have packets waiting
+  std::vector<Ipv4Address> GetDestinations ();
+  /// Number of queued packets, all destinations together
+  uint32_t GetSize ();
+  /// Packets held, expired ones not yet purged included; for observers that must not cause drops
+  uint32_t GetHeldSize () const { return m_size; }
+  /// \returns the heap bytes held by the queue, packet contents included
+  uint32_t GetMemoryUsage () const;
+
+  uint32_t GetMaxQueueLen () const { return m_maxLenPerDst; }
+  void SetMaxQueueLen (uint32_t len) { m_maxLenPerDst = len; }
+  Time GetQueueTimeout () const { return m_queueTimeout; }
+  void SetQueueTimeout (Time t) { m_queueTimeout = t; }
+  void SetDropCallback (DropCallback cb) { m_drop = cb; }
+  uint32_t GetTimeoutDrops () const { return m_timeoutDrops; }
+  uint32_t GetOverflowDrops () const { return m_overflowDrops; }
+
+private:
+  std::map<Ipv4Address, std::vector<QueueEntry> > m_queue;
+  /// Remove all expired entries
+  void Purge ();
+  /// Notify that packet is dropped from queue
+  void Drop (QueueEntry en, std::string reason);
+  uint32_t m_maxLenPerDst; // Maximum number of packets buffered per destination
+  Time m_queueTimeout; // Maximum time a packet may wait for its handshake
+  uint32_t m_size; // Packets held over all destinations
+  uint32_t m_timeoutDrops; // Packets dropped because their handshake took too long
+  uint32_t m_overflowDrops; // Packets dropped because their destination queue was full
+  DropCallback m_drop;
+};
+
+} // namespace carp
+} // namespace ns3
+
+#endif /* CARP_PACKET_QUEUE_H */
@@ -5,9 +5,28 @@
 #include "ns3/random-variable-stream.h"
 #include "ns3/inet-socket-address.h"
 #include "ns3/udp-header.h"
+#include "ns3/udp-l4-protocol.h"
 #include "ns3/string.h"
 #include "ns3/pointer.h"
+#include "ns3/double.h"
+#include "ns3/boolean.h"
+#include "ns3/udp-socket-factory.h"
+#include "ns3/udp-socket-impl.h"
+#include "ns3/ipv4-end-point.h"
+#include "ns3/mobility-model.h"
+#include "ns3/energy-source-container.h"
+#include "ns3/ipv4-route.h"
+#include "ns3/uinteger.h"
+#include "ns3/trace-source-accessor.h"
+#include "ns3/wifi-net-device.h"
+#include "ns3/wifi-mac-header.h"
+#include "ns3/wifi-remote-station-manager.h"
+#include "ns3/uan-net-device.h"
+#include "ns3/uan-phy.h"
+#include "ns3/uan-header-common.h"
+#include "ns3/carp-link-net-device.h"
 #include <algorithm>
+#include <cstring>
 #include <limits>
 
 
@@ -17,49 +36,703 @@ NS_LOG_COMPONENT_DEFINE ("CarpRoutingProtocol");
 
 namespace carp {
 
-------------------------------------------------------------------
+//-----------------------------------------------------------------------------
 // Routing Protocol Implementation
-------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+const uint32_t RoutingProtocol::CARP_PORT = 1698;
+// Experimental protocol number (RFC 3692)
+const uint8_t RoutingProtocol::AGGREGATE_PROTOCOL = 253;
+
+//-----------------------------------------------------------------------------
+/// Tag used by CARP implementation
+
+class DeferredRouteOutputTag : public Tag
+{
+
+public:
+  DeferredRouteOutputTag (int32_t o = -1) : Tag (), m_oif (o) {}
+
+  static TypeId GetTypeId ()
+  {
+    static TypeId tid = TypeId ("ns3::carp::DeferredRouteOutputTag").SetParent<Tag> ()
+      .SetGroupName("Carp")
+      .AddConstructor<DeferredRouteOutputTag> ()
+    ;
+    return tid;
+  }
+
+  TypeId  GetInstanceTypeId () const
+  {
+    return GetTypeId ();
+  }
+
+  int32_t GetInterface() const
+  {
+    return m_oif;
+  }
+
+  void SetInterface(int32_t oif)
+  {
+    m_oif = oif;
+  }
+
+  uint32_t GetSerializedSize () const
+  {
+    return sizeof(int32_t);
+  }
+
+  void  Serialize (TagBuffer i) const
+  {
+    i.WriteU32 (m_oif);
+  }
+
+  void  Deserialize (TagBuffer i)
+  {
+    m_oif = i.ReadU32 ();
+  }
+
+  void  Print (std::ostream &os) const
+  {
+    os << "DeferredRouteOutputTag: output interface = " << m_oif;
+  }
+
+private:
+  /// Positive if output device is fixed in RouteOutput
+  int32_t m_oif;
+};
+
+NS_OBJECT_ENSURE_REGISTERED (DeferredRouteOutputTag);
+
+/// Marks CARP's own control packets, whose UDP header is not yet added when RouteOutput sees them
+class ControlTag : public Tag
+{
+
+public:
+  static TypeId GetTypeId ()
+  {
+    static TypeId tid = TypeId ("ns3::carp::ControlTag").SetParent<Tag> ()
+      .SetGroupName("Carp")
+      .AddConstructor<ControlTag> ()
+    ;
+    return tid;
+  }
+
+  TypeId  GetInstanceTypeId () const
+  {
+    return GetTypeId ();
+  }
+
+  uint32_t GetSerializedSize () const
+  {
+    return 0;
+  }
+
+  void  Serialize (TagBuffer i) const
+  {
+  }
+
+  void  Deserialize (TagBuffer i)
+  {
+  }
+
+  void  Print (std::ostream &os) const
+  {
+    os << "ControlTag";
+  }
+};
+
+NS_OBJECT_ENSURE_REGISTERED (ControlTag);
+
+/// Node that handed a data packet over on its last hop, and whether it waits for a DATA_ACK
+class HopTag : public Tag
+{
+
+public:
+  HopTag (Ipv4Address prevHop = Ipv4Address (), bool ackRequested = false)
+    : Tag (), m_prevHop (prevHop), m_ackRequested (ackRequested) {}
+
+  static TypeId GetTypeId ()
+  {
+    static TypeId tid = TypeId ("ns3::carp::HopTag").SetParent<Tag> ()
+      .SetGroupName("Carp")
+      .AddConstructor<HopTag> ()
+    ;
+    return tid;
+  }
+
+  TypeId  GetInstanceTypeId () const
+  {
+    return GetTypeId ();
+  }
+
+  Ipv4Address GetPrevHop () const
+  {
+    return m_prevHop;
+  }
+
+  bool IsAckRequested () const
+  {
+    return m_ackRequested;
+  }
+
+  uint32_t GetSerializedSize () const
+  {
+    return sizeof(uint32_t) + 1;
+  }
+
+  void  Serialize (TagBuffer i) const
+  {
+    i.WriteU32 (m_prevHop.Get ());
+    i.WriteU8 (m_ackRequested);
+  }
+
+  void  Deserialize (TagBuffer i)
+  {
+    m_prevHop.Set (i.ReadU32 ());
+    m_ackRequested = i.ReadU8 ();
+  }
+
+  void  Print (std::ostream &os) const
+  {
+    os << "HopTag: previous hop = " << m_prevHop << ", ack requested = " << m_ackRequested;
+  }
+
+private:
+  Ipv4Address m_prevHop;
+  bool m_ackRequested;
+};
+
+NS_OBJECT_ENSURE_REGISTERED (HopTag);
+
+
 RoutingProtocol::RoutingProtocol ()
-  : m_nextHopWait (MilliSeconds (10)),
+  : m_nb (Seconds (3)),
+    m_nextHopWait (MilliSeconds (10)),
+    m_handshakeBackoff (MilliSeconds (100)),
+    m_maxHandshakeRetries (6),
+    m_handshakeRetries (0),
+    m_handshakeDrops (0),
+    m_enableBroadcast (true),
+    m_requestId (0),
+    m_seqNo (0),
+    m_lqAlpha (0.125),
+    m_snrMax (30.0),
+    m_geoPrefilter (false),
+    m_sinkPosition (Vector ()),
+    m_minProgress (0.0),
+    m_broadcastThreshold (3),
+    m_broadcastJitter (MilliSeconds (20)),
+    m_hopCount (std::numeric_limits<uint32_t>::max ()),
+    m_isSink (false),
+    m_helloInterval (Seconds (5)),
+    m_helloRound (0),
+    m_relayLifetime (Seconds (2)),
+    m_urgentRelayLifetime (Seconds (10)),
+    m_dataAckTimeout (Seconds (0)),
+    m_maxDataAckRetries (3),
+    m_expectedNeighbors (0),
+    m_compact (false),
+    m_compactLimit (32),
+    m_piggybackMaxSize (0),
+    m_claimWindow (MilliSeconds (10)),
+    m_reversePathLimit (64),
+    m_reversePathLifetime (Seconds (30)),
+    m_aggregationDelay (Seconds (0)),
+    m_aggregationMaxSize (512),
+    m_aggregateId (0),
+    m_relaysSelected (Seconds (0)),
+    m_pingTimer (Timer::CANCEL_ON_DESTROY),
+    m_backoffTimer (Timer::CANCEL_ON_DESTROY),
+    m_helloTimer (Timer::CANCEL_ON_DESTROY),
+    m_helloForwardTimer (Timer::CANCEL_ON_DESTROY),
+    m_queue (64, Seconds (30))
+
+{
+  BindTimers ();
+}
+
+// CopyObject skips attribute construction, so bulk installs resolve the attributes once
+// on a prototype and copy their values from it; per-node state starts empty
+RoutingProtocol::RoutingProtocol (const RoutingProtocol &o)
+  : Ipv4RoutingProtocol (o),
+    m_nb (Seconds (3)),
+    m_nextHopWait (MilliSeconds (10)),
+    m_handshakeBackoff (MilliSeconds (100)),
+    m_maxHandshakeRetries (6),
+    m_handshakeRetries (0),
+    m_handshakeDrops (0),
+    m_enableBroadcast (o.m_enableBroadcast),
     m_requestId (0),
     m_seqNo (0),
-    m_enableBroadcast (true)
+    m_lqAlpha (0.125),
+    m_snrMax (30.0),
+    m_geoPrefilter (false),
+    m_sinkPosition (Vector ()),
+    m_minProgress (0.0),
+    m_broadcastThreshold (3),
+    m_broadcastJitter (MilliSeconds (20)),
+    m_hopCount (std::numeric_limits<uint32_t>::max ()),
+    m_isSink (false),
+    m_helloInterval (Seconds (5)),
+    m_helloRound (0),
+    m_relayLifetime (Seconds (2)),
+    m_urgentRelayLifetime (Seconds (10)),
+    m_dataAckTimeout (Seconds (0)),
+    m_maxDataAckRetries (3),
+    m_expectedNeighbors (0),
+    m_compact (false),
+    m_compactLimit (32),
+    m_piggybackMaxSize (0),
+    m_claimWindow (MilliSeconds (10)),
+    m_reversePathLimit (64),
+    m_reversePathLifetime (Seconds (30)),
+    m_aggregationDelay (Seconds (0)),
+    m_aggregationMaxSize (512),
+    m_aggregateId (0),
+    m_relaysSelected (Seconds (0)),
+    m_pingTimer (Timer::CANCEL_ON_DESTROY),
+    m_backoffTimer (Timer::CANCEL_ON_DESTROY),
+    m_helloTimer (Timer::CANCEL_ON_DESTROY),
+    m_helloForwardTimer (Timer::CANCEL_ON_DESTROY),
+    m_queue (64, Seconds (30))
+{
+  // Every readable and writable attribute, so a new one is copied without touching this list
+  TypeId tid = GetTypeId ();
+  for (std::size_t i = 0; i < tid.GetAttributeN (); ++i)
+    {
+      struct TypeId::AttributeInformation info = tid.GetAttribute (i);
+      if (!(info.flags & TypeId::ATTR_GET) || !(info.flags & TypeId::ATTR_SET)
+          || !info.accessor->HasGetter () || !info.accessor->HasSetter ())
+        {
+          continue;
+        }
+      Ptr<AttributeValue> value = info.checker->Create ();
+      o.GetAttribute (info.name, *value);
+      SetAttribute (info.name, *value);
+    }
+  if (m_compact)
+    {
+      // One generator for the whole field; AssignStreams still makes runs reproducible
+      m_uniformRandomVariable = o.m_uniformRandomVariable;
+    }
+  BindTimers ();
+}
 
+void
+RoutingProtocol::BindTimers ()
+{
+  if (m_uniformRandomVariable == 0)
+    {
+      m_uniformRandomVariable = CreateObject<UniformRandomVariable> ();
+    }
+  m_pingTimer.SetFunction (&RoutingProtocol::SelectRelay, this);
+  m_backoffTimer.SetFunction (&RoutingProtocol::RetryHandshake, this);
+  m_helloTimer.SetFunction (&RoutingProtocol::HelloTimerExpire, this);
+  m_helloForwardTimer.SetFunction (&RoutingProtocol::ForwardHello, this);
+  m_queue.SetDropCallback (MakeCallback (&RoutingProtocol::PendingDrop, this));
+}
+
+RoutingProtocol::~RoutingProtocol ()
+{
+}
+
+void
+RoutingProtocol::DoDispose ()
 {
+  m_ipv4 = 0;
+  m_lo = 0;
+  for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::iterator iter = m_socketAddress.begin ();
+       iter != m_socketAddress.end (); iter++)
+    {
+      iter->first->Close ();
+    }
+  m_socketAddress.clear ();
+  for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::iterator iter = m_socketSubnetBroadcastAddress.begin ();
+       iter != m_socketSubnetBroadcastAddress.end (); iter++)
+    {
+      iter->first->Close ();
+    }
+  m_socketSubnetBroadcastAddress.clear ();
+  for (std::map<uint64_t, Dissemination>::iterator i = m_dissemination.begin (); i != m_dissemination.end (); ++i)
+    {
+      i->second.m_rebroadcast.Cancel ();
+    }
+  m_dissemination.clear ();
+  for (std::map<uint64_t, Claim>::iterator i = m_offers.begin (); i != m_offers.end (); ++i)
+    {
+      i->second.m_event.Cancel ();
+    }
+  m_offers.clear ();
+  for (std::map<uint64_t, Claim>::iterator i = m_claims.begin (); i != m_claims.end (); ++i)
+    {
+      i->second.m_event.Cancel ();
+    }
+  m_claims.clear ();
+  for (std::map<Ipv4Address, Aggregate>::iterator i = m_aggregates.begin (); i != m_aggregates.end (); ++i)
+    {
+      i->second.m_flush.Cancel ();
+    }
+  m_aggregates.clear ();
+  for (std::map<uint64_t, HopAck>::iterator i = m_hopAcks.begin (); i != m_hopAcks.end (); ++i)
+    {
+      i->second.m_timeout.Cancel ();
+    }
+  m_hopAcks.clear ();
+  Ipv4RoutingProtocol::DoDispose ();
 }
 
 
-TypedId RoutingProtocol::GetTypeId (void)
+TypeId
+RoutingProtocol::GetTypeId (void)
 {
   static TypeId tid = TypeId ("ns3::carp::RoutingProtocol")
    .SetParent<Ipv4RoutingProtocol>()
    .SetGroupName ("Carp")
    .AddConstructor<RoutingProtocol> ()
+   .AddAttribute ("IsSink", "This node is the sink: it originates the HELLOs that build the hop gradient",
+                  BooleanValue (false),
+                  MakeBooleanAccessor (&RoutingProtocol::m_isSink),
+                  MakeBooleanChecker ())
+   .AddAttribute ("HelloInterval", "Period of the sink's HELLO rounds",
+                  TimeValue (Seconds (5)),
+                  MakeTimeAccessor (&RoutingProtocol::m_helloInterval),
+                  MakeTimeChecker ())
    .AddAttribute("PingWaitTime", "Period of waiting for neighbor's to reply with a PONG packet", 
                  TimeValue (MilliSeconds (10)), 
  		 MakeTimeAccessor (&RoutingProtocol::m_nextHopWait), 
  		 MakeTimeChecker ())
+   .AddAttribute ("HandshakeBackoff", "Base delay before a handshake that got no PONG is retried, doubled at every retry",
+                  TimeValue (MilliSeconds (100)),
+                  MakeTimeAccessor (&RoutingProtocol::m_handshakeBackoff),
+                  MakeTimeChecker ())
+   .AddAttribute ("MaxHandshakeRetries", "Handshakes retried without a PONG before the buffered packets are dropped",
+                  UintegerValue (6),
+                  MakeUintegerAccessor (&RoutingProtocol::m_maxHandshakeRetries),
+                  MakeUintegerChecker<uint32_t> ())
+   .AddAttribute ("LinkQualityAlpha", "Weight of the newest PHY sample in the per-neighbor link quality average",
+                  DoubleValue (0.125),
+                  MakeDoubleAccessor (&RoutingProtocol::m_lqAlpha),
+                  MakeDoubleChecker<double> (0.0, 1.0))
+   .AddAttribute ("LinkQualitySnrMax", "SNR (dB) at and above which a link is considered perfect",
+                  DoubleValue (30.0),
+                  MakeDoubleAccessor (&RoutingProtocol::m_snrMax),
+                  MakeDoubleChecker<double> (0.0))
+   .AddAttribute ("GeographicPrefilter", "PING only the neighbors that make positive progress towards the sink",
+                  BooleanValue (false),
+                  MakeBooleanAccessor (&RoutingProtocol::m_geoPrefilter),
+                  MakeBooleanChecker ())
+   .AddAttribute ("SinkPosition", "Position of the sink used by the geographic prefilter",
+                  VectorValue (Vector ()),
+                  MakeVectorAccessor (&RoutingProtocol::m_sinkPosition),
+                  MakeVectorChecker ())
+   .AddAttribute ("MinProgress", "Least progress (m) towards the sink for a neighbor to be PINGed",
+                  DoubleValue (0.0),
+                  MakeDoubleAccessor (&RoutingProtocol::m_minProgress),
+                  MakeDoubleChecker<double> (0.0))
+   .AddAttribute ("BackupRelayLifetime", "How long the ranked relays of a handshake may be used for failover",
+                  TimeValue (Seconds (2)),
+                  MakeTimeAccessor (&RoutingProtocol::m_relayLifetime),
+                  MakeTimeChecker ())
+   .AddAttribute ("UrgentRelayLifetime", "How long urgent packets reuse the last ranked relays instead of "
+                  "waiting for a new handshake",
+                  TimeValue (Seconds (10)),
+                  MakeTimeAccessor (&RoutingProtocol::m_urgentRelayLifetime),
+                  MakeTimeChecker ())
+   .AddAttribute ("DataAckTimeout", "Time a relay has to acknowledge a data packet before it is resent through "
+                  "the next ranked relay, zero disables the per-hop DATA_ACK",
+                  TimeValue (Seconds (0)),
+                  MakeTimeAccessor (&RoutingProtocol::m_dataAckTimeout),
+                  MakeTimeChecker ())
+   .AddAttribute ("MaxDataAckRetries", "Resends of a packet whose DATA_ACK is missing before it is dropped",
+                  UintegerValue (3),
+                  MakeUintegerAccessor (&RoutingProtocol::m_maxDataAckRetries),
+                  MakeUintegerChecker<uint32_t> ())
+   .AddAttribute ("MaxQueueLen", "Maximum number of packets buffered per destination during a handshake",
+                  UintegerValue (64),
+                  MakeUintegerAccessor (&RoutingProtocol::SetMaxQueueLen,
+                                        &RoutingProtocol::GetMaxQueueLen),
+                  MakeUintegerChecker<uint32_t> ())
+   .AddAttribute ("MaxQueueTime", "Maximum time packets can wait for a handshake before being dropped",
+                  TimeValue (Seconds (30)),
+                  MakeTimeAccessor (&RoutingProtocol::SetMaxQueueTime,
+                                    &RoutingProtocol::GetMaxQueueTime),
+                  MakeTimeChecker ())
+   .AddAttribute ("BroadcastCounterThreshold", "Copies of a broadcast overheard before a node gives up rebroadcasting it",
+                  UintegerValue (3),
+                  MakeUintegerAccessor (&RoutingProtocol::m_broadcastThreshold),
+                  MakeUintegerChecker<uint32_t> (1))
+   .AddAttribute ("BroadcastMaxJitter", "Upper bound of the random delay before a broadcast is relayed",
+                  TimeValue (MilliSeconds (20)),
+                  MakeTimeAccessor (&RoutingProtocol::m_broadcastJitter),
+                  MakeTimeChecker ())
+   .AddAttribute ("ExpectedNeighbors", "Neighbor table entries reserved when the agent is installed",
+                  UintegerValue (0),
+                  MakeUintegerAccessor (&RoutingProtocol::m_expectedNeighbors),
+                  MakeUintegerChecker<uint32_t> ())
+   .AddAttribute ("CompactState", "Keep neighbors in a bounded table of packed entries and share one "
+                  "random variable between the agents of a bulk install",
+                  BooleanValue (false),
+                  MakeBooleanAccessor (&RoutingProtocol::m_compact),
+                  MakeBooleanChecker ())
+   .AddAttribute ("CompactNeighborLimit", "Maximum neighbors kept in compact state mode",
+                  UintegerValue (32),
+                  MakeUintegerAccessor (&RoutingProtocol::m_compactLimit),
+                  MakeUintegerChecker<uint32_t> (1))
+   .AddAttribute ("PiggybackMaxSize", "Largest IP packet (bytes) sent on the PING itself when no relay is known, "
+                  "zero disables the zero-handshake mode",
+                  UintegerValue (0),
+                  MakeUintegerAccessor (&RoutingProtocol::m_piggybackMaxSize),
+                  MakeUintegerChecker<uint32_t> ())
+   .AddAttribute ("ClaimWindow", "Contention window in which the receivers of a DATA_PING claim its data",
+                  TimeValue (MilliSeconds (10)),
+                  MakeTimeAccessor (&RoutingProtocol::m_claimWindow),
+                  MakeTimeChecker ())
+   .AddAttribute ("ReversePathLimit", "Most sensors a node keeps a downlink next hop for, zero disables downlink routing",
+                  UintegerValue (64),
+                  MakeUintegerAccessor (&RoutingProtocol::m_reversePathLimit),
+                  MakeUintegerChecker<uint32_t> ())
+   .AddAttribute ("ReversePathLifetime", "How long a downlink next hop stays usable without fresh uplink traffic",
+                  TimeValue (Seconds (30)),
+                  MakeTimeAccessor (&RoutingProtocol::m_reversePathLifetime),
+                  MakeTimeChecker ())
+   .AddAttribute ("AggregationDelay", "Longest a relay holds a routine packet to merge it with others to the "
+                  "same destination, zero disables aggregation",
+                  TimeValue (Seconds (0)),
+                  MakeTimeAccessor (&RoutingProtocol::m_aggregationDelay),
+                  MakeTimeChecker ())
+   .AddAttribute ("AggregationMaxSize", "Largest aggregate packet (bytes), IP header included",
+                  UintegerValue (512),
+                  MakeUintegerAccessor (&RoutingProtocol::m_aggregationMaxSize),
+                  MakeUintegerChecker<uint32_t> (64, 65535))
+   .AddTraceSource ("PendingDrop", "A packet waiting for a handshake timed out or overflowed the buffer",
+                    MakeTraceSourceAccessor (&RoutingProtocol::m_pendingDropTrace),
+                    "ns3::carp::RoutingProtocol::PendingDropTracedCallback")
+   .AddTraceSource ("ClassDelay", "A packet was handed to a relay, with its traffic class and the time it waited",
+                    MakeTraceSourceAccessor (&RoutingProtocol::m_classDelayTrace),
+                    "ns3::carp::RoutingProtocol::ClassDelayTracedCallback")
    ;
 
 
    return tid; 
 }
 
-// This is to confirm if the address is a neighbor of a node
-bool
-Neighbors::IsNeighbor (Ipv4Address addr)
+int64_t
+RoutingProtocol::AssignStreams (int64_t stream)
 {
-  //Purge ();
-  for (std::vector<Neighbor>::const_iterator i = m_nb.begin ();
-       i != m_nb.end (); ++i)
+  NS_LOG_FUNCTION (this << stream);
+  m_uniformRandomVariable->SetStream (stream);
+  return 1;
+}
+
+Neighbors::Neighbors (Time delay)
+  : m_ntimer (Timer::CANCEL_ON_DESTROY),
+    m_compact (false),
+    m_limit (0),
+    m_lqAlpha (0.125),
+    m_snrMax (30.0)
+{
+  m_ntimer.SetDelay (delay);
+}
+
+void
+Neighbors::SetCompact (uint32_t limit)
+{
+  NS_ASSERT (Count () == 0);
+  m_compact = true;
+  m_limit = limit;
+  std::vector<Neighbor> ().swap (m_nb);
+  m_packed.reserve (limit);
+}
+
+uint32_t
+Neighbors::GetMemoryUsage () const
+{
+  // The purge timer never gets a function, so it holds no heap implementation
+  return m_nb.capacity () * sizeof (Neighbor) + m_packed.capacity () * sizeof (PackedNeighbor)
+         + m_byMac.size () * (4 * sizeof (void *) + sizeof (std::pair<const Address, uint32_t>))
+         + m_arp.capacity () * sizeof (Ptr<ArpCache>);
+}
+
+uint32_t
+Neighbors::Count () const
+{
+  return m_compact ? m_packed.size () : m_nb.size ();
+}
+
+void
+Neighbors::PackMac (Address mac, PackedNeighbor &p)
+{
+  uint8_t buffer[Address::MAX_SIZE + 2];
+  mac.CopyAllTo (buffer, sizeof (buffer));
+  p.m_macType = buffer[0];
+  p.m_macLen = buffer[1] <= sizeof (p.m_mac) ? buffer[1] : 0; // Longer addresses are left to ARP
+  std::memcpy (p.m_mac, buffer + 2, p.m_macLen);
+}
+
+Neighbors::Neighbor
+Neighbors::Get (uint32_t id) const
+{
+  if (!m_compact)
+    {
+      return m_nb[id];
+    }
+  const PackedNeighbor &p = m_packed[id];
+  Address mac;
+  if (p.m_macLen > 0)
+    {
+      mac = Address (p.m_macType, p.m_mac, p.m_macLen);
+    }
+  Neighbor n (Ipv4Address (p.m_address), mac, MilliSeconds (p.m_expireMs));
+  n.close = p.m_flags & PACKED_CLOSE;
+  n.m_snr = p.m_snr / 4.0;
+  n.m_prr = p.m_prr / 255.0;
+  n.m_lqValid = p.m_flags & PACKED_LQ_VALID;
+  n.m_position = Vector (p.m_position[0], p.m_position[1], p.m_position[2]);
+  n.m_hasPosition = p.m_flags & PACKED_HAS_POSITION;
+  n.m_hopCount = (p.m_hopCount == 255) ? std::numeric_limits<uint32_t>::max () : p.m_hopCount;
+  return n;
+}
+
+void
+Neighbors::Put (uint32_t id, const Neighbor &n)
+{
+  if (m_compact)
+    {
+      Pack (n, m_packed[id]); // FindByMac scans the packed addresses, so there is no index to keep
+      return;
+    }
+  Address old = m_nb[id].m_hardwareAddress;
+  m_nb[id] = n;
+  Address mac = n.m_hardwareAddress;
+  if (mac == old)
+    {
+      return;
+    }
+  std::map<Address, uint32_t>::iterator it = m_byMac.find (old);
+  if (it != m_byMac.end () && it->second == id)
+    {
+      m_byMac.erase (it);
+    }
+  if (!mac.IsInvalid ())
+    {
+      m_byMac[mac] = id;
+    }
+}
+
+void
+Neighbors::Pack (const Neighbor &n, PackedNeighbor &p)
+{
+  p.m_address = n.m_neighborAddress.Get ();
+  p.m_expireMs = (uint32_t) std::min<int64_t> (n.m_expireTime.GetMilliSeconds (), std::numeric_limits<uint32_t>::max ());
+  p.m_position[0] = n.m_position.x;
+  p.m_position[1] = n.m_position.y;
+  p.m_position[2] = n.m_position.z;
+  p.m_macLen = 0;
+  if (!n.m_hardwareAddress.IsInvalid ())
+    {
+      PackMac (n.m_hardwareAddress, p);
+    }
+  p.m_snr = (uint8_t) std::min (255.0, std::max (0.0, n.m_snr * 4.0 + 0.5));
+  p.m_prr = (uint8_t) (std::min (1.0, std::max (0.0, n.m_prr)) * 255.0 + 0.5);
+  p.m_hopCount = (uint8_t) std::min<uint32_t> (n.m_hopCount, 255);
+  p.m_flags = (n.m_lqValid ? PACKED_LQ_VALID : 0) | (n.m_hasPosition ? PACKED_HAS_POSITION : 0)
+    | (n.close ? PACKED_CLOSE : 0);
+}
+
+int32_t
+Neighbors::Find (Ipv4Address addr) const
+{
+  if (m_compact)
     {
-      if (i->m_neighborAddress == addr)
+      uint32_t a = addr.Get ();
+      for (uint32_t id = 0; id < m_packed.size (); ++id)
         {
-         return true;
+          if (m_packed[id].m_address == a)
+            {
+              return id;
+            }
         }
+      return -1;
     }
-  return false;
+  for (uint32_t id = 0; id < m_nb.size (); ++id)
+    {
+      if (m_nb[id].m_neighborAddress == addr)
+        {
+          return id;
+        }
+    }
+  return -1;
+}
+
+int32_t
+Neighbors::FindByMac (Address mac) const
+{
+  if (m_compact)
+    {
+      // At most CompactNeighborLimit entries of 32 bytes: a scan beats a map node per neighbor
+      PackedNeighbor key;
+      key.m_macLen = 0;
+      if (!mac.IsInvalid ())
+        {
+          PackMac (mac, key);
+        }
+      if (key.m_macLen == 0)
+        {
+          return -1;
+        }
+      for (uint32_t id = 0; id < m_packed.size (); ++id)
+        {
+          const PackedNeighbor &p = m_packed[id];
+          if (p.m_macLen == key.m_macLen && p.m_macType == key.m_macType
+              && std::memcmp (p.m_mac, key.m_mac, key.m_macLen) == 0)
+            {
+              return id;
+            }
+        }
+      return -1;
+    }
+  std::map<Address, uint32_t>::const_iterator it = m_byMac.find (mac);
+  return (it == m_byMac.end ()) ? -1 : (int32_t) it->second;
+}
+
+void
+Neighbors::Append (const Neighbor &n)
+{
+  if (!m_compact)
+    {
+      // Added empty and then filled through Put so the address index stays in step
+      m_nb.push_back (Neighbor (Ipv4Address (), Address (), Seconds (0)));
+      Put (m_nb.size () - 1, n);
+      return;
+    }
+  if (m_packed.size () < m_limit)
+    {
+      m_packed.push_back (PackedNeighbor ());
+      Put (m_packed.size () - 1, n);
+      return;
+    }
+  if (m_limit == 0)
+    {
+      return;
+    }
+  // Bounded table: replace the entry closest to expiry
+  uint32_t victim = 0;
+  for (uint32_t id = 1; id < m_packed.size (); ++id)
+    {
+      if (m_packed[id].m_expireMs < m_packed[victim].m_expireMs)
+        {
+          victim = id;
+        }
+    }
+  Put (victim, n);
+}
+
+// This is to confirm if the address is a neighbor of a node
+bool
+Neighbors::IsNeighbor (Ipv4Address addr)
+{
+  //Purge ();
+  return Find (addr) >= 0;
 }
 
 // Time it takes the neighbor to expire
@@ -67,128 +740,1451 @@ Time
 Neighbors::GetExpireTime (Ipv4Address addr)
 {
   // Purge ();
-  for (std::vector<Neighbor>::const_iterator i = m_nb.begin (); i
-       != m_nb.end (); ++i)
+  int32_t id = Find (addr);
+  if (id < 0)
     {
-      if (i->m_neighborAddress == addr)
-        {
-          return (i->m_expireTime - Simulator::Now ());
-        }
+      return Seconds (0);
     }
-  return Seconds (0);
+  return (Get (id).m_expireTime - Simulator::Now ());
 }
 
 // Update the neighbor status
 void
 Neighbors::Update (Ipv4Address addr, Time expire)
 {
-  for (std::vector<Neighbor>::iterator i = m_nb.begin (); i != m_nb.end (); ++i)
+  int32_t id = Find (addr);
+  if (id >= 0)
     {
-      if (i->m_neighborAddress == addr)
+      Neighbor n = Get (id);
+      n.m_expireTime = std::max (expire + Simulator::Now (), n.m_expireTime);
+      if (n.m_hardwareAddress.IsInvalid ())
         {
-          i->m_expireTime
-            = std::max (expire + Simulator::Now (), i->m_expireTime);
-          if (i->m_hardwareAddress == Mac48Address ())
-            {
-               i->m_hardwareAddress = LookupMacAddress (i->m_neighborAddress);
-            }
-          return;
+          n.m_hardwareAddress = LookupMacAddress (n.m_neighborAddress);
         }
+      Put (id, n);
+      return;
     }
   // NS_LOG_LOGIC ("Open link to " << addr);
   Neighbor neighbor (addr, LookupMacAddress (addr), expire + Simulator::Now ());
-  m_nb.push_back (neighbor);
+  Append (neighbor);
   // Purge ();
 }
 
-// The use of SendTo module to send streams of data
-void 
-RoutingProtocol::SendTo(Ptr<Socket> socket, Ptr<Packet> packet, Ipv4Address dest)
+// Fold a PHY/MAC sample into the EWMAs of the neighbor owning the address, found through the address index
+void
+Neighbors::UpdateLinkQuality (Address mac, double snr, bool success)
 {
-  socket->SendTo(packet, 0, InetSocketAddress(dest, CARP_PORT);
+  int32_t id = FindByMac (mac);
+  if (id < 0)
+    {
+      return;
+    }
+  Neighbor n = Get (id);
+  double sample = success ? 1.0 : 0.0;
+  if (!n.m_lqValid && success)
+    {
+      n.m_snr = snr;
+      n.m_prr = sample;
+      n.m_lqValid = true;
+    }
+  else
+    {
+      if (success)
+        {
+          n.m_snr = m_lqAlpha * snr + (1.0 - m_lqAlpha) * n.m_snr;
+        }
+      n.m_prr = m_lqAlpha * sample + (1.0 - m_lqAlpha) * n.m_prr;
+    }
+  Put (id, n);
 }
 
-// Method used by the sink to broadcast the hello packet
-void RoutingProtocol::SendHello ()
+// Link quality is the frame success ratio scaled by how close the SNR is to a perfect channel
+double
+Neighbors::GetLinkQuality (Ipv4Address addr)
 {
-  // The need to revisit the use of socket & Ipv4InterfaceAddress are required
-
- for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j = m_socketAddress.begin (); m_socketAddress.end(); ++j)
- {
-  Ptr<Socket> socket = j->first;
-  Ipv4InterfaceAddress iface = j->second;
-
-  HelloHeader helloHeader (/*hopCount*/ 0, /*Origin*/ iface.GetLocal ());
-  Ptr<Packet> packet = Create<Packet> (); // You can create packet size here //
-  packet->AddHeader (helloHeader);
-  TypeHeader tHeader (CARPTYPE_HELLO);
-  packet->AddHeader (tHeader); // You can also add the TTL tag
+  int32_t id = Find (addr);
+  if (id < 0)
+    {
+      return 0.0;
+    }
+  Neighbor n = Get (id);
+  if (!n.m_lqValid)
+    {
+      return 0.0;
+    }
+  double snrScore = std::min (1.0, std::max (0.0, n.m_snr / m_snrMax));
+  return n.m_prr * snrScore;
+}
 
-  Ipv4Address destination;
-  if (iface.GetMask () == Ipv4Mask::GetOnes ())
-  {
-    destination = Ipv4Address ("255.255.255.255");
-  }
-  else
-  {
-    destination = iface.GetBroadcast ();
-  }
- }
-  Time jitter = Time (MilliSeconds (m_uniformRandomVariable->GetInteger (0,10));
-  Simulator::Schedule (jitter, &RoutingProtocol::SendTo, this, socket, packet, destination);
-  
+uint32_t
+Neighbors::GetSize ()
+{
+  uint32_t alive = 0;
+  for (uint32_t id = 0; id < Count (); ++id)
+    {
+      if (Get (id).m_expireTime >= Simulator::Now ())
+        {
+          alive++;
+        }
+    }
+  return alive;
 }
 
-// How nodes manage packets with hello headers
-void RoutingProtocol::ProcessHello (Ptr<Packet> p, Ipv4Address receiver)
+Ipv4Address
+Neighbors::GetAddress (Address mac)
 {
- Helloheader helloheader;
- p->RemoveHeader(helloheader); 
- Ipv4Address src = helloheader.GetOrigin ();
- if (dst == Ipv4Address("255.255.255.255")) // If it is a broadcast message ?
- {
- // A for loop might be needed somewhere, also the timer might be unnecessary given the assumption of nodes remaining in a static position for a while
-  Neighbor::Update(src, timer);
-  uint8_t hop = helloheader.GetHopCount () + 1;
-  helloheader.SetHopCount (hop);
-  Ipv4Address recv_addr = m_ipv4->GetAddress(m_ipv4->GetInterfaceForAddress(receiver),0);
-  helloheader.SetOrigin (recv_addr);
-  p->AddHeader (helloheader);
-  // NodeDevice store; //Maybe a struct data type
-  Ptr<NetDevice> dev = m_ipv4->GetNetDevice(m_ipv4->GetInterfaceAddress(receiver));
-  Ipv4Address recv_addr = m_ipv4->GetAddress(m_ipv4->GetInterfaceForAddress(receiver),0);
-
-  // Store (dev, recv_addr, hop) // This stores the IP address, hop count for every node in the topology
-  // SendHello (); // During the Hello broadcast  period, every receiving node re-propagates the HELLO message
-  return;
- }
- // The need to create a node store which keeps track of the hop count status of each node from the sink per every HELLO packet received
+  int32_t id = FindByMac (mac);
+  if (id < 0)
+    {
+      return Ipv4Address ();
+    }
+  return Get (id).m_neighborAddress;
 }
 
-// Method to initiate PING, PONG, PACKET FORWARDING
-Ptr<Ipv4Route>
-RoutingProtocol::RouteOutput (Ptr<Packet> p, const Ipv4Header &header, Ptr<NetDevice> oif, Socket::SocketErrno &sockerr)
+void
+Neighbors::SetHopCount (Ipv4Address addr, uint32_t hopCount)
+{
+  int32_t id = Find (addr);
+  if (id >= 0)
+    {
+      Neighbor n = Get (id);
+      n.m_hopCount = hopCount;
+      Put (id, n);
+    }
+}
+
+uint32_t
+Neighbors::GetHopCount (Ipv4Address addr)
+{
+  int32_t id = Find (addr);
+  return (id < 0) ? std::numeric_limits<uint32_t>::max () : Get (id).m_hopCount;
+}
+
+bool
+Neighbors::HasOutwardNeighbor (uint32_t hopCount)
+{
+  for (uint32_t id = 0; id < Count (); ++id)
+    {
+      Neighbor n = Get (id);
+      if (n.m_expireTime >= Simulator::Now () && n.m_hopCount > hopCount)
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
+void
+Neighbors::SetPosition (Ipv4Address addr, Vector position)
+{
+  int32_t id = Find (addr);
+  if (id >= 0)
+    {
+      Neighbor n = Get (id);
+      n.m_position = position;
+      n.m_hasPosition = true;
+      Put (id, n);
+    }
+}
+
+// Neighbors without a known position are left out; the caller falls back to a broadcast PING
+std::vector<Ipv4Address>
+Neighbors::GetProgressCandidates (Vector self, Vector sink, double minProgress)
+{
+  std::vector<Ipv4Address> candidates;
+  double own = CalculateDistance (self, sink);
+  for (uint32_t id = 0; id < Count (); ++id)
+    {
+      Neighbor n = Get (id);
+      if (!n.m_hasPosition || n.m_expireTime < Simulator::Now ())
+        {
+          continue;
+        }
+      if (own - CalculateDistance (n.m_position, sink) > minProgress)
+        {
+          candidates.push_back (n.m_neighborAddress);
+        }
+    }
+  return candidates;
+}
+
+// Frames carry the sender's hardware address, so ARP request/reply traffic is not needed for CARP neighbors
+void
+Neighbors::LearnHardwareAddress (Ipv4Address addr, Address mac, Ptr<NetDevice> dev)
+{
+  int32_t id = Find (addr);
+  if (id >= 0)
+    {
+      Neighbor n = Get (id);
+      n.m_hardwareAddress = mac;
+      Put (id, n);
+    }
+  for (std::vector<Ptr<ArpCache> >::const_iterator i = m_arp.begin (); i != m_arp.end (); ++i)
+    {
+      if ((*i)->GetDevice () != dev)
+        {
+          continue;
+        }
+      ArpCache::Entry * entry = (*i)->Lookup (addr);
+      if (entry == 0)
+        {
+          entry = (*i)->Add (addr);
+          entry->SetMacAddress (mac);
+          entry->MarkPermanent ();
+        }
+      else if (!entry->IsWaitReply () && entry->GetMacAddress () != mac)
+        {
+          // An ARP request in flight keeps its pending packets; only settled entries are corrected
+          entry->SetMacAddress (mac);
+        }
+    }
+}
+
+void
+Neighbors::AddArpCache (Ptr<ArpCache> a)
+{
+  m_arp.push_back (a);
+}
+
+void
+Neighbors::DelArpCache (Ptr<ArpCache> a)
+{
+  m_arp.erase (std::remove (m_arp.begin (), m_arp.end (), a), m_arp.end ());
+}
+
+Address
+Neighbors::LookupMacAddress (Ipv4Address addr)
+{
+  Address hwaddr;
+  for (std::vector<Ptr<ArpCache> >::const_iterator i = m_arp.begin ();
+       i != m_arp.end (); ++i)
+    {
+      ArpCache::Entry * entry = (*i)->Lookup (addr);
+      if (entry != 0 && (entry->IsAlive () || entry->IsPermanent ()) && !entry->IsExpired ())
+        {
+          hwaddr = entry->GetMacAddress ();
+          break;
+        }
+    }
+  return hwaddr;
+}
+
+// The use of SendTo module to send streams of data
+void 
+RoutingProtocol::SendTo(Ptr<Socket> socket, Ptr<Packet> packet, Ipv4Address dest)
+{
+  packet->AddPacketTag (ControlTag ());
+  socket->SendTo(packet, 0, InetSocketAddress(dest, CARP_PORT));
+}
+
+bool
+RoutingProtocol::IsMyOwnAddress (Ipv4Address src)
+{
+  for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j =
+         m_socketAddress.begin (); j != m_socketAddress.end (); ++j)
+    {
+      Ipv4InterfaceAddress iface = j->second;
+      if (src == iface.GetLocal ())
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
+// Broadcast a HELLO advertising our hop count on every CARP interface
+void
+RoutingProtocol::SendHello (HelloHeader const & helloheader)
+{
+  for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j = m_socketAddress.begin ();
+       j != m_socketAddress.end (); ++j)
+    {
+      Ipv4InterfaceAddress iface = j->second;
+      HelloHeader hello = helloheader;
+      hello.SetOrigin (iface.GetLocal ());
+      hello.SetSink (m_isSink ? iface.GetLocal () : m_sinkAddress);
+      Vector position;
+      if (GetPosition (position))
+        {
+          hello.SetPosition (position);
+        }
+      Ptr<Packet> packet = Create<Packet> ();
+      packet->AddHeader (hello);
+      TypeHeader tHeader (CARPTYPE_HELLO);
+      packet->AddHeader (tHeader);
+
+      Ipv4Address destination;
+      if (iface.GetMask () == Ipv4Mask::GetOnes ())
+        {
+          destination = Ipv4Address ("255.255.255.255");
+        }
+      else
+        {
+          destination = iface.GetBroadcast ();
+        }
+      SendTo (j->first, packet, destination);
+    }
+}
+
+// The sink opens a new gradient round every HelloInterval, so hop counts follow topology changes
+void
+RoutingProtocol::HelloTimerExpire ()
+{
+  m_hopCount = 0;
+  m_helloRound++;
+  HelloHeader hello (0);
+  hello.SetRound (m_helloRound);
+  SendHello (hello);
+  Time jitter = MilliSeconds (m_uniformRandomVariable->GetInteger (0, 10));
+  m_helloTimer.Schedule (m_helloInterval + jitter);
+}
+
+void
+RoutingProtocol::ForwardHello ()
+{
+  HelloHeader hello (m_hopCount);
+  hello.SetRound (m_helloRound);
+  SendHello (hello);
+}
+
+/*
+ * Hop gradient. Every node takes one more hop than the best HELLO of the
+ * current sink round and re-advertises it after a random delay, so the flood
+ * costs one HELLO per node and round. A HELLO of a newer round resets the
+ * count; within a round only an improvement is passed on.
+ */
+void
+RoutingProtocol::ProcessHello (Ptr<Packet> p, Ipv4Address receiver)
+{
+  HelloHeader helloheader;
+  p->RemoveHeader (helloheader);
+  Ipv4Address src = helloheader.GetOrigin ();
+  // Nodes that hear each other every round stay neighbors even if one HELLO is lost
+  m_nb.Update (src, m_helloInterval * 2);
+  m_nb.SetPosition (src, helloheader.GetPosition ());
+  m_nb.SetHopCount (src, helloheader.GetHopCount ());
+  if (m_isSink)
+    {
+      return;
+    }
+  uint32_t hop = helloheader.GetHopCount () + 1;
+  bool known = m_hopCount != std::numeric_limits<uint32_t>::max ();
+  bool newRound = !known || (int16_t) (helloheader.GetRound () - m_helloRound) > 0;
+  if (!newRound && (helloheader.GetRound () != m_helloRound || hop >= m_hopCount))
+    {
+      return; // Stale round or no shorter path
+    }
+  m_helloRound = helloheader.GetRound ();
+  m_hopCount = hop;
+  m_sinkAddress = helloheader.GetSink ();
+  NS_LOG_LOGIC ("Hop count " << m_hopCount << " in round " << m_helloRound << " via " << src);
+  // The pending HELLO carries the best count known when it fires; the header field is 8 bits wide
+  if (!m_helloForwardTimer.IsRunning () && hop < 255)
+    {
+      m_helloForwardTimer.Schedule (Seconds (m_uniformRandomVariable->GetValue (0, m_broadcastJitter.GetSeconds ())));
+    }
+}
+
+bool
+RoutingProtocol::GetPosition (Vector &position) const
+{
+  Ptr<MobilityModel> mobility = m_ipv4->GetObject<MobilityModel> ();
+  if (mobility == 0)
+    {
+      return false;
+    }
+  position = mobility->GetPosition ();
+  return true;
+}
+
+// Dispatch a received CARP control packet on its type
+void
+RoutingProtocol::RecvCarp (Ptr<Socket> socket)
+{
+  Address sourceAddress;
+  Ptr<Packet> packet = socket->RecvFrom (sourceAddress);
+  InetSocketAddress inetSourceAddr = InetSocketAddress::ConvertFrom (sourceAddress);
+  Ipv4Address sender = inetSourceAddr.GetIpv4 ();
+  std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator it = m_socketAddress.find (socket);
+  if (it == m_socketAddress.end ())
+    {
+      NS_LOG_DEBUG ("Packet received on an unknown CARP socket");
+      return;
+    }
+  Ipv4Address receiver = it->second.GetLocal ();
+  // Any control packet proves the sender is a neighbor; keep it at least as long as relays learned from it
+  m_nb.Update (sender, m_relayLifetime);
+
+  TypeHeader tHeader (CARPTYPE_PING);
+  packet->RemoveHeader (tHeader);
+  if (!tHeader.IsValid ())
+    {
+      NS_LOG_DEBUG ("CARP message " << packet->GetUid () << " with unknown type received. Drop");
+      return;
+    }
+  switch (tHeader.Get ())
+    {
+    case CARPTYPE_HELLO:
+      {
+        ProcessHello (packet, receiver);
+        break;
+      }
+    case CARPTYPE_PING:
+      {
+        PingHeader pingHeader;
+        packet->RemoveHeader (pingHeader);
+        RecvPing (packet, pingHeader);
+        break;
+      }
+    case CARPTYPE_PONG:
+      {
+        PongHeader pongHeader;
+        packet->RemoveHeader (pongHeader);
+        RecvPong (packet, pongHeader);
+        break;
+      }
+    case CARPTYPE_DATA_PING:
+      {
+        PingHeader pingHeader;
+        packet->RemoveHeader (pingHeader);
+        RecvDataPing (packet, pingHeader, sender, receiver);
+        break;
+      }
+    case CARPTYPE_DATA_ACK:
+      {
+        // Claims of a DATA_PING, and per-hop acknowledgements of relayed data
+        if (packet->GetSize () >= DataAckHeader ().GetSerializedSize ())
+          {
+            DataAckHeader ackHeader;
+            packet->RemoveHeader (ackHeader);
+            RecvDataAck (ackHeader, sender);
+          }
+        break;
+      }
+    }
+}
+
+// Fraction of the first energy source left, 1 on mains-powered nodes
+double
+RoutingProtocol::GetResidualEnergy () const
+{
+  Ptr<EnergySourceContainer> sources = m_ipv4->GetObject<EnergySourceContainer> ();
+  if (sources != 0 && sources->GetN () > 0)
+    {
+      return sources->Get (0)->GetEnergyFraction ();
+    }
+  return 1.0;
+}
+
+RoutingProtocol::StateSnapshot
+RoutingProtocol::GetStateSnapshot ()
+{
+  StateSnapshot state;
+  state.m_neighbors = m_nb.GetSize ();
+  state.m_hopCount = m_hopCount;
+  state.m_relay = Ipv4Address ();
+  state.m_linkQuality = 0.0;
+  if (GetRelay (state.m_relay))
+    {
+      state.m_linkQuality = m_nb.GetLinkQuality (state.m_relay);
+    }
+  state.m_queue = m_queue.GetHeldSize (); // Purging here would move drops to the dump schedule
+  state.m_energy = GetResidualEnergy ();
+  return state;
+}
+
+/*
+ * Packets are counted at their full size, although copies may share one
+ * buffer. Not counted: events waiting in the simulator's scheduler and the
+ * ARP cache entries, which belong to the IPv4 interfaces.
+ */
+uint32_t
+RoutingProtocol::GetMemoryUsage ()
+{
+  // A red-black tree node carries three pointers and a colour next to its value
+  const uint32_t mapNode = 4 * sizeof (void *);
+  // Timer::SetFunction allocates the bound call: vtable, member function pointer and object
+  const uint32_t timerImpl = 4 * sizeof (void *);
+  uint32_t bytes = sizeof (*this) + m_nb.GetMemoryUsage ();
+  bytes += 4 * timerImpl; // PING, backoff, HELLO and HELLO forwarding timers
+  bytes += (m_pongs.capacity () + m_relays.capacity ()) * sizeof (RelayCandidate);
+  bytes += m_queue.GetMemoryUsage ();
+  bytes += m_dissemination.size () * (mapNode + sizeof (std::pair<const uint64_t, Dissemination>));
+  for (std::map<uint64_t, Dissemination>::const_iterator i = m_dissemination.begin (); i != m_dissemination.end (); ++i)
+    {
+      bytes += i->second.m_packet ? sizeof (Packet) + i->second.m_packet->GetSize () : 0;
+    }
+  bytes += (m_offers.size () + m_claims.size ()) * (mapNode + sizeof (std::pair<const uint64_t, Claim>));
+  for (std::map<uint64_t, Claim>::const_iterator i = m_offers.begin (); i != m_offers.end (); ++i)
+    {
+      bytes += i->second.m_packet ? sizeof (Packet) + i->second.m_packet->GetSize () : 0;
+    }
+  for (std::map<uint64_t, Claim>::const_iterator i = m_claims.begin (); i != m_claims.end (); ++i)
+    {
+      bytes += i->second.m_packet ? sizeof (Packet) + i->second.m_packet->GetSize () : 0;
+    }
+  bytes += m_reversePaths.size () * (mapNode + sizeof (std::pair<const Ipv4Address, ReversePath>));
+  bytes += m_aggregates.size () * (mapNode + sizeof (std::pair<const Ipv4Address, Aggregate>));
+  for (std::map<Ipv4Address, Aggregate>::const_iterator i = m_aggregates.begin (); i != m_aggregates.end (); ++i)
+    {
+      bytes += i->second.m_packets.capacity () * sizeof (QueueEntry);
+      bytes += sizeof (Packet) + i->second.m_payload->GetSize ();
+    }
+  bytes += m_hopAcks.size () * (mapNode + sizeof (std::pair<const uint64_t, HopAck>));
+  for (std::map<uint64_t, HopAck>::const_iterator i = m_hopAcks.begin (); i != m_hopAcks.end (); ++i)
+    {
+      Ptr<const Packet> p = i->second.m_entry.GetPacket ();
+      bytes += p ? sizeof (Packet) + p->GetSize () : 0;
+    }
+  // Each control socket is a UDP socket bound to its own endpoint
+  uint32_t sockets = m_socketAddress.size () + m_socketSubnetBroadcastAddress.size ();
+  bytes += sockets * (mapNode + sizeof (std::pair<const Ptr<Socket>, Ipv4InterfaceAddress>)
+                      + sizeof (UdpSocketImpl) + sizeof (Ipv4EndPoint));
+  if (!m_compact)
+    {
+      bytes += sizeof (UniformRandomVariable);
+    }
+  return bytes;
+}
+
+// Answer a PING with our gradient, queue, energy and our view of the channel to the requester
+void
+RoutingProtocol::RecvPing (Ptr<Packet> p, PingHeader const &pingheader)
+{
+  Ipv4Address origin = pingheader.GetOrigin ();
+  if (IsMyOwnAddress (origin) || m_hopCount == std::numeric_limits<uint32_t>::max ())
+    {
+      return; // No gradient to the sink yet, nothing to offer
+    }
+  PongHeader pongHeader (/*queue*/ std::min<uint32_t> (m_queue.GetSize (), 255), /*hopCount*/ std::min<uint32_t> (m_hopCount, 255), /*dst*/ origin,
+                         /*origin*/ Ipv4Address (), GetResidualEnergy (), m_nb.GetLinkQuality (origin));
+  // Spread the PONGs over the first half of the requester's wait to limit collisions
+  Time jitter = Seconds (m_uniformRandomVariable->GetValue (0, m_nextHopWait.GetSeconds () / 2));
+  Simulator::Schedule (jitter, &RoutingProtocol::SendPong, this, pongHeader, origin);
+}
+
+void
+RoutingProtocol::SendPong (PongHeader const & pongheader, Ipv4Address src)
+{
+  for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j = m_socketAddress.begin ();
+       j != m_socketAddress.end (); ++j)
+    {
+      Ipv4InterfaceAddress iface = j->second;
+      if (!iface.GetMask ().IsMatch (iface.GetLocal (), src))
+        {
+          continue;
+        }
+      PongHeader pong = pongheader;
+      pong.SetOrigin (iface.GetLocal ());
+      Ptr<Packet> packet = Create<Packet> ();
+      packet->AddHeader (pong);
+      TypeHeader tHeader (CARPTYPE_PONG);
+      packet->AddHeader (tHeader);
+      SendTo (j->first, packet, src);
+      return;
+    }
+}
+
+void
+RoutingProtocol::RecvPong (Ptr<Packet> p, PongHeader const &pongheader)
+{
+  if (!m_pingTimer.IsRunning () || !IsMyOwnAddress (pongheader.GetDst ()))
+    {
+      return; // Late PONG or not for us
+    }
+  if (pongheader.GetHopCount () >= m_hopCount)
+    {
+      return; // No progress towards the sink
+    }
+  Ipv4Address origin = pongheader.GetOrigin ();
+  // Links are asymmetric: when both directions are measured, the weaker one bounds the relay
+  double lq = pongheader.GetLinkQuality ();
+  double local = m_nb.GetLinkQuality (origin);
+  if (local > 0)
+    {
+      lq = (lq > 0) ? std::min (lq, local) : local;
+    }
+  RelayCandidate candidate;
+  candidate.m_address = origin;
+  candidate.m_hopCount = pongheader.GetHopCount ();
+  m_nb.SetHopCount (origin, pongheader.GetHopCount ());
+  candidate.m_score = lq * pongheader.GetEnergy () * (1.0 - pongheader.GetQueue () / 255.0);
+  m_pongs.push_back (candidate);
+}
+
+// Fewer hops first, then the better channel/queue/energy score
+bool
+RoutingProtocol::RankRelays (const RelayCandidate &a, const RelayCandidate &b)
+{
+  if (a.m_hopCount != b.m_hopCount)
+    {
+      return a.m_hopCount < b.m_hopCount;
+    }
+  return a.m_score > b.m_score;
+}
+
+// Keep the whole ranked PONG set: the runners-up are the failover relays until the set expires
+void
+RoutingProtocol::SelectRelay ()
+{
+  if (m_pongs.empty ())
+    {
+      NS_LOG_LOGIC ("Handshake closed without a PONG");
+      std::vector<Ipv4Address> pending = m_queue.GetDestinations ();
+      if (pending.empty ())
+        {
+          m_handshakeRetries = 0;
+          return;
+        }
+      if (m_handshakeRetries >= m_maxHandshakeRetries)
+        {
+          NS_LOG_LOGIC ("No PONG after " << m_handshakeRetries + 1 << " handshakes, drop the buffered packets");
+          m_handshakeRetries = 0;
+          for (std::vector<Ipv4Address>::const_iterator d = pending.begin (); d != pending.end (); ++d)
+            {
+              std::vector<QueueEntry> batch = m_queue.DequeueAll (*d);
+              m_handshakeDrops += batch.size ();
+              for (std::vector<QueueEntry>::const_iterator i = batch.begin (); i != batch.end (); ++i)
+                {
+                  PendingDrop (i->GetPacket (), i->GetIpv4Header ());
+                  i->GetErrorCallback () (i->GetPacket (), i->GetIpv4Header (), Socket::ERROR_NOROUTETOHOST);
+                }
+            }
+          return;
+        }
+      // Exponential backoff, jittered so that stuck neighbors do not retry in step
+      double backoff = m_handshakeBackoff.GetSeconds () * (1u << std::min<uint32_t> (m_handshakeRetries, 16));
+      m_handshakeRetries++;
+      m_backoffTimer.Schedule (Seconds (backoff * m_uniformRandomVariable->GetValue (0.5, 1.0)));
+      return;
+    }
+  m_handshakeRetries = 0;
+  std::stable_sort (m_pongs.begin (), m_pongs.end (), RankRelays);
+  m_relays.swap (m_pongs);
+  m_pongs.clear ();
+  m_relaysSelected = Simulator::Now ();
+  NS_LOG_LOGIC ("Relay " << m_relays.front ().m_address << " selected with "
+                << m_relays.size () - 1 << " backups");
+  SendPacketFromQueue ();
+}
+
+bool
+RoutingProtocol::GetRelay (Ipv4Address &relay, TrafficClass c)
+{
+  // An older ranking beats waiting PingWaitTime for an alarm
+  Time lifetime = (c == CLASS_URGENT) ? std::max (m_urgentRelayLifetime, m_relayLifetime) : m_relayLifetime;
+  if (m_relays.empty () || Simulator::Now () > m_relaysSelected + lifetime)
+    {
+      return false;
+    }
+  relay = m_relays.front ().m_address;
+  return true;
+}
+
+void
+RoutingProtocol::RelayFailed (Ipv4Address relay)
+{
+  for (std::vector<RelayCandidate>::iterator i = m_relays.begin (); i != m_relays.end (); ++i)
+    {
+      if (i->m_address == relay)
+        {
+          m_relays.erase (i);
+          NS_LOG_LOGIC ("Relay " << relay << " failed, " << m_relays.size () << " backups left");
+          return;
+        }
+    }
+}
+
+Ptr<Ipv4Route>
+RoutingProtocol::NeighborRoute (Ipv4Address dst, Ipv4Address gateway)
+{
+  for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j = m_socketAddress.begin ();
+       j != m_socketAddress.end (); ++j)
+    {
+      Ipv4InterfaceAddress iface = j->second;
+      if (!iface.GetMask ().IsMatch (iface.GetLocal (), gateway))
+        {
+          continue;
+        }
+      Ptr<Ipv4Route> route = Create<Ipv4Route> ();
+      route->SetDestination (dst);
+      route->SetGateway (gateway);
+      route->SetSource (iface.GetLocal ());
+      route->SetOutputDevice (m_ipv4->GetNetDevice (m_ipv4->GetInterfaceForAddress (iface.GetLocal ())));
+      return route;
+    }
+  return Ptr<Ipv4Route> ();
+}
+
+/*
+ * Downlink routing. Every unicast data packet a neighbor hands us records that
+ * neighbor as the next hop back to the packet's origin, so the sink and the
+ * relays on the uplink path can reach a sensor without flooding. The table is
+ * bounded: when full, the entry closest to expiry makes room.
+ */
+void
+RoutingProtocol::LearnReversePath (Ipv4Address origin, Ipv4Address prevHop)
+{
+  if (m_reversePathLimit == 0 || origin == m_sinkAddress)
+    {
+      return;
+    }
+  std::map<Ipv4Address, ReversePath>::iterator it = m_reversePaths.find (origin);
+  if (it == m_reversePaths.end () && m_reversePaths.size () >= m_reversePathLimit)
+    {
+      std::map<Ipv4Address, ReversePath>::iterator oldest = m_reversePaths.begin ();
+      for (std::map<Ipv4Address, ReversePath>::iterator i = m_reversePaths.begin (); i != m_reversePaths.end (); ++i)
+        {
+          if (i->second.m_expire < oldest->second.m_expire)
+            {
+              oldest = i;
+            }
+        }
+      m_reversePaths.erase (oldest);
+    }
+  ReversePath &path = m_reversePaths[origin];
+  path.m_nextHop = prevHop;
+  path.m_expire = Simulator::Now () + m_reversePathLifetime;
+}
+
+bool
+RoutingProtocol::GetReversePath (Ipv4Address dst, Ipv4Address &nextHop)
+{
+  // Traffic to the sink always goes through the ranked relays
+  if (dst == m_sinkAddress)
+    {
+      return false;
+    }
+  std::map<Ipv4Address, ReversePath>::iterator it = m_reversePaths.find (dst);
+  if (it == m_reversePaths.end ())
+    {
+      return false;
+    }
+  if (it->second.m_expire < Simulator::Now ())
+    {
+      m_reversePaths.erase (it);
+      return false;
+    }
+  nextHop = it->second.m_nextHop;
+  return true;
+}
+
+// Broadcast the PING, or with the geographic prefilter unicast it to the neighbors closer to the sink only
+void
+RoutingProtocol::StartHandshake (Ipv4Address dst, uint32_t numPkt)
+{
+  if (m_pingTimer.IsRunning () || m_backoffTimer.IsRunning ())
+    {
+      return; // One handshake at a time, and none while backing off
+    }
+  m_requestId++;
+  m_pongs.clear ();
+  m_pingTimer.Schedule (m_nextHopWait);
+  PingHeader pingHeader (numPkt, Ipv4Address (), std::min<uint32_t> (m_hopCount, 255));
+  std::vector<Ipv4Address> candidates;
+  Vector self;
+  if (m_geoPrefilter && GetPosition (self))
+    {
+      candidates = m_nb.GetProgressCandidates (self, m_sinkPosition, m_minProgress);
+    }
+  if (candidates.empty ())
+    {
+      // Hop-based logic: every neighbor may answer
+      SendPing (pingHeader, Ipv4Address ("255.255.255.255"));
+      return;
+    }
+  NS_LOG_LOGIC ("Geographic prefilter keeps " << candidates.size () << " PING candidates towards " << dst);
+  for (std::vector<Ipv4Address>::const_iterator i = candidates.begin (); i != candidates.end (); ++i)
+    {
+      SendPing (pingHeader, *i);
+    }
+}
+
+void
+RoutingProtocol::RetryHandshake ()
+{
+  std::vector<Ipv4Address> pending = m_queue.GetDestinations ();
+  if (pending.empty ())
+    {
+      m_handshakeRetries = 0;
+      return;
+    }
+  StartHandshake (pending.front (), m_queue.GetSize ());
+}
+
+void
+RoutingProtocol::SendPing (PingHeader const & pingheader, Ipv4Address dst)
+{
+  for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j = m_socketAddress.begin ();
+       j != m_socketAddress.end (); ++j)
+    {
+      Ptr<Socket> socket = j->first;
+      Ipv4InterfaceAddress iface = j->second;
+      Ipv4Address destination = dst;
+      if (dst.IsBroadcast ())
+        {
+          if (iface.GetMask () != Ipv4Mask::GetOnes ())
+            {
+              destination = iface.GetBroadcast ();
+            }
+        }
+      else if (!iface.GetMask ().IsMatch (iface.GetLocal (), dst))
+        {
+          continue; // Neighbor is not on this interface
+        }
+      PingHeader ping = pingheader;
+      ping.SetOrigin (iface.GetLocal ());
+      Ptr<Packet> packet = Create<Packet> ();
+      packet->AddHeader (ping);
+      TypeHeader tHeader (CARPTYPE_PING);
+      packet->AddHeader (tHeader);
+      SendTo (socket, packet, destination);
+    }
+}
+
+Ptr<Ipv4Route>
+RoutingProtocol::LoopbackRoute (const Ipv4Header & hdr, Ptr<NetDevice> oif) const
+{
+  NS_ASSERT (m_lo != 0);
+  Ptr<Ipv4Route> rt = Create<Ipv4Route> ();
+  rt->SetDestination (hdr.GetDestination ());
+  std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j = m_socketAddress.begin ();
+  if (oif)
+    {
+      // Iterate to find an address on the oif device
+      for (j = m_socketAddress.begin (); j != m_socketAddress.end (); ++j)
+        {
+          Ipv4Address addr = j->second.GetLocal ();
+          int32_t interface = m_ipv4->GetInterfaceForAddress (addr);
+          if (oif == m_ipv4->GetNetDevice (static_cast<uint32_t> (interface)))
+            {
+              rt->SetSource (addr);
+              break;
+            }
+        }
+    }
+  else
+    {
+      rt->SetSource (j->second.GetLocal ());
+    }
+  NS_ASSERT_MSG (rt->GetSource () != Ipv4Address (), "Valid CARP source address not found");
+  rt->SetGateway (Ipv4Address ("127.0.0.1"));
+  rt->SetOutputDevice (m_lo);
+  return rt;
+}
+
+void
+RoutingProtocol::DeferredRouteOutput (Ptr<const Packet> p, const Ipv4Header & header,
+                                      UnicastForwardCallback ucb, ErrorCallback ecb)
+{
+  NS_ASSERT (p != 0 && p != Ptr<Packet> ());
+  // Urgent packets may still use the relays of the last handshake instead of waiting for a new one
+  TrafficClass trafficClass = PriorityTag::Classify (p, header);
+  Ipv4Address relay;
+  while (trafficClass == CLASS_URGENT && GetRelay (relay, CLASS_URGENT))
+    {
+      Ptr<Ipv4Route> route = NeighborRoute (header.GetDestination (), relay);
+      if (route)
+        {
+          ClassSent (p, trafficClass, Seconds (0));
+          SendToRelay (route, p, header, ucb, ecb);
+          return;
+        }
+      RelayFailed (relay);
+    }
+  if (OfferOnPing (p, header, ucb, ecb))
+    {
+      return;
+    }
+  QueueEntry newEntry (p, header, ucb, ecb);
+  newEntry.SetTrafficClass (trafficClass);
+  m_queue.Enqueue (newEntry);
+  NS_LOG_LOGIC ("Add packet " << p->GetUid () << " to handshake buffer. Protocol " << (uint16_t) header.GetProtocol ());
+  // A handshake already open for earlier packets serves this one too
+  StartHandshake (header.GetDestination (), m_queue.GetSize ());
+}
+
+// The whole batch goes out back to back as soon as a relay is known, instead of one handshake per packet
+void
+RoutingProtocol::SendPacketFromQueue ()
+{
+  std::vector<Ipv4Address> dsts = m_queue.GetDestinations ();
+  for (std::vector<Ipv4Address>::const_iterator d = dsts.begin (); d != dsts.end (); ++d)
+    {
+      Ipv4Address relay;
+      Ptr<Ipv4Route> route;
+      while (route == 0 && GetRelay (relay))
+        {
+          route = NeighborRoute (*d, relay);
+          if (route == 0)
+            {
+              RelayFailed (relay);
+            }
+        }
+      if (route == 0)
+        {
+          return; // No usable relay left, the packets stay for the next handshake
+        }
+      std::vector<QueueEntry> batch = m_queue.DequeueAll (*d);
+      NS_LOG_LOGIC ("Release " << batch.size () << " buffered packets to " << *d << " via " << relay);
+      for (std::vector<QueueEntry>::const_iterator i = batch.begin (); i != batch.end (); ++i)
+        {
+          ClassSent (i->GetPacket (), i->GetTrafficClass (), i->GetHoldTime ());
+          SendToRelay (route, i->GetPacket (), i->GetIpv4Header (), i->GetUnicastForwardCallback (),
+                       i->GetErrorCallback ());
+        }
+    }
+}
+
+void
+RoutingProtocol::PendingDrop (Ptr<const Packet> p, const Ipv4Header & header)
+{
+  m_pendingDropTrace (p, header);
+}
+
+// The UDP header is only added after RouteOutput, so locally sent control is known by its tag
+bool
+RoutingProtocol::IsControl (Ptr<const Packet> p, const Ipv4Header & header)
+{
+  ControlTag control;
+  if (p->PeekPacketTag (control))
+    {
+      return true;
+    }
+  UdpHeader udpHeader;
+  return header.GetProtocol () == UdpL4Protocol::PROT_NUMBER && p->GetSize () >= udpHeader.GetSerializedSize ()
+         && p->PeekHeader (udpHeader) && udpHeader.GetDestinationPort () == CARP_PORT;
+}
+
+void
+RoutingProtocol::ClassSent (Ptr<const Packet> p, TrafficClass c, Time held)
+{
+  ControlTag control;
+  if (p->PeekPacketTag (control))
+    {
+      return; // The per-class statistics cover data only
+    }
+  m_classDelay[c].Add (held.GetSeconds ());
+  m_classDelayTrace (p, c, held);
+}
+
+/*
+ * Zero-handshake mode. With no valid relay, a packet of at most PiggybackMaxSize
+ * bytes is broadcast inside a DATA_PING instead of waiting for PONGs. Every
+ * receiver closer to the sink starts a claim timer that is shorter the fitter
+ * it is; the first to fire broadcasts a DATA_ACK naming the packet, which
+ * cancels the other timers and the sender's fallback, and forwards the packet.
+ * If nobody claims it in time the sender queues it for a regular handshake.
+ */
+bool
+RoutingProtocol::OfferOnPing (Ptr<const Packet> p, const Ipv4Header & header,
+                              UnicastForwardCallback ucb, ErrorCallback ecb)
+{
+  if (m_piggybackMaxSize == 0 || p->GetSize () + header.GetSerializedSize () > m_piggybackMaxSize
+      || m_hopCount == std::numeric_limits<uint32_t>::max ())
+    {
+      return false;
+    }
+  uint64_t key = PacketKey (header);
+  if (m_offers.find (key) != m_offers.end ())
+    {
+      return false; // Already offered once
+    }
+  Ptr<Packet> data = p->Copy ();
+  DeferredRouteOutputTag tag;
+  data->RemovePacketTag (tag);
+  Ipv4Header ipHeader = header;
+  if (Node::ChecksumEnabled ())
+    {
+      ipHeader.EnableChecksum ();
+    }
+  data->AddHeader (ipHeader);
+
+  Claim offer;
+  offer.m_packet = data;
+  offer.m_entry = QueueEntry (p, header, ucb, ecb);
+  offer.m_entry.SetTrafficClass (PriorityTag::Classify (p, header));
+  offer.m_expire = Simulator::Now () + m_claimWindow * 2 + m_nextHopWait;
+  offer.m_event = Simulator::Schedule (m_claimWindow * 2 + m_nextHopWait, &RoutingProtocol::OfferTimeout, this, key);
+  m_offers.insert (std::make_pair (key, offer));
+
+  NS_LOG_LOGIC ("Offer " << p->GetUid () << " on a DATA_PING towards " << header.GetDestination ());
+  PingHeader pingHeader (1, Ipv4Address (), std::min<uint32_t> (m_hopCount, 255));
+  for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j = m_socketAddress.begin ();
+       j != m_socketAddress.end (); ++j)
+    {
+      Ipv4InterfaceAddress iface = j->second;
+      Ipv4Address destination = Ipv4Address ("255.255.255.255");
+      if (iface.GetMask () != Ipv4Mask::GetOnes ())
+        {
+          destination = iface.GetBroadcast ();
+        }
+      PingHeader ping = pingHeader;
+      ping.SetOrigin (iface.GetLocal ());
+      Ptr<Packet> packet = data->Copy ();
+      packet->AddHeader (ping);
+      TypeHeader tHeader (CARPTYPE_DATA_PING);
+      packet->AddHeader (tHeader);
+      SendTo (j->first, packet, destination);
+    }
+  return true;
+}
+
+void
+RoutingProtocol::OfferTimeout (uint64_t key)
+{
+  std::map<uint64_t, Claim>::iterator it = m_offers.find (key);
+  if (it == m_offers.end ())
+    {
+      return;
+    }
+  QueueEntry entry = it->second.m_entry;
+  // Keep the key until the lifetime of the offer so a late DATA_PING duplicate is not sent again
+  it->second.m_entry = QueueEntry ();
+  NS_LOG_LOGIC ("DATA_PING of " << entry.GetPacket ()->GetUid () << " not claimed, fall back to the handshake");
+  m_queue.Enqueue (entry);
+  StartHandshake (entry.GetIpv4Header ().GetDestination (), m_queue.GetSize ());
+}
+
+void
+RoutingProtocol::RecvDataPing (Ptr<Packet> p, PingHeader const &pingheader, Ipv4Address sender, Ipv4Address receiver)
+{
+  Time now = Simulator::Now ();
+  for (std::map<uint64_t, Claim>::iterator i = m_claims.begin (); i != m_claims.end (); )
+    {
+      if (i->second.m_expire < now && !i->second.m_event.IsRunning ())
+        {
+          m_claims.erase (i++);
+        }
+      else
+        {
+          ++i;
+        }
+    }
+  for (std::map<uint64_t, Claim>::iterator i = m_offers.begin (); i != m_offers.end (); )
+    {
+      if (i->second.m_expire < now && !i->second.m_event.IsRunning ())
+        {
+          m_offers.erase (i++);
+        }
+      else
+        {
+          ++i;
+        }
+    }
+
+  Ipv4Header ipHeader;
+  p->PeekHeader (ipHeader);
+  uint64_t key = PacketKey (ipHeader);
+  if (IsMyOwnAddress (pingheader.GetOrigin ()) || m_claims.find (key) != m_claims.end ())
+    {
+      return; // Already contending, or it was forwarded through us before
+    }
+  bool forUs = m_ipv4->IsDestinationAddress (ipHeader.GetDestination (),
+                                             m_ipv4->GetInterfaceForAddress (receiver));
+  if (!forUs && (m_hopCount == std::numeric_limits<uint32_t>::max ()
+                 || m_hopCount >= pingheader.GetHopCount () || ipHeader.GetTtl () <= 1))
+    {
+      return; // No progress towards the sink through us
+    }
+  Claim claim;
+  claim.m_packet = p;
+  claim.m_device = m_ipv4->GetNetDevice (m_ipv4->GetInterfaceForAddress (receiver));
+  claim.m_sender = sender;
+  // Same fitness as a PONG score, turned into a backoff: the fittest receiver fires first
+  double fitness = m_nb.GetLinkQuality (sender) * GetResidualEnergy ()
+    * (1.0 - std::min<uint32_t> (m_queue.GetSize (), 255) / 255.0);
+  Time backoff = Seconds (0);
+  if (!forUs)
+    {
+      backoff = m_claimWindow * (1.0 - fitness)
+        + Seconds (m_uniformRandomVariable->GetValue (0, m_claimWindow.GetSeconds () / 10));
+    }
+  claim.m_expire = now + m_claimWindow * 2 + m_nextHopWait;
+  claim.m_event = Simulator::Schedule (backoff, &RoutingProtocol::ClaimData, this, key);
+  m_claims.insert (std::make_pair (key, claim));
+}
+
+void
+RoutingProtocol::ClaimData (uint64_t key)
+{
+  std::map<uint64_t, Claim>::iterator it = m_claims.find (key);
+  if (it == m_claims.end ())
+    {
+      return;
+    }
+  Ipv4Header ipHeader;
+  it->second.m_packet->PeekHeader (ipHeader);
+  DataAckHeader ackHeader (ipHeader.GetSource (), ipHeader.GetIdentification ());
+  for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j = m_socketAddress.begin ();
+       j != m_socketAddress.end (); ++j)
+    {
+      Ipv4InterfaceAddress iface = j->second;
+      Ipv4Address destination = Ipv4Address ("255.255.255.255");
+      if (iface.GetMask () != Ipv4Mask::GetOnes ())
+        {
+          destination = iface.GetBroadcast ();
+        }
+      Ptr<Packet> packet = Create<Packet> ();
+      packet->AddHeader (ackHeader);
+      TypeHeader tHeader (CARPTYPE_DATA_ACK);
+      packet->AddHeader (tHeader);
+      SendTo (j->first, packet, destination);
+    }
+  NS_LOG_LOGIC ("Claim DATA_PING from " << ipHeader.GetSource () << " id " << ipHeader.GetIdentification ());
+  LearnReversePath (ipHeader.GetSource (), it->second.m_sender);
+  // Hand the packet to IP as if it had arrived on its own: local delivery or Forwarding takes it from there
+  it->second.m_packet->AddPacketTag (HopTag (it->second.m_sender));
+  Ptr<Ipv4L3Protocol> l3 = m_ipv4->GetObject<Ipv4L3Protocol> ();
+  l3->Receive (it->second.m_device, it->second.m_packet, Ipv4L3Protocol::PROT_NUMBER,
+               Address (), Address (), NetDevice::PACKET_HOST);
+  it->second.m_packet = 0;
+}
+
+void
+RoutingProtocol::RecvDataAck (DataAckHeader const &ackheader, Ipv4Address sender)
+{
+  uint64_t key = ((uint64_t) ackheader.GetOrigin ().Get () << 16) | ackheader.GetIdentification ();
+  std::map<uint64_t, HopAck>::iterator hop = m_hopAcks.find (key);
+  if (hop != m_hopAcks.end () && hop->second.m_relay == sender)
+    {
+      hop->second.m_timeout.Cancel ();
+      m_hopAcks.erase (hop);
+    }
+  std::map<uint64_t, Claim>::iterator it = m_claims.find (key);
+  if (it != m_claims.end () && it->second.m_event.IsRunning ())
+    {
+      NS_LOG_LOGIC ("DATA_PING from " << ackheader.GetOrigin () << " claimed by a neighbor");
+      it->second.m_event.Cancel ();
+      it->second.m_packet = 0;
+    }
+  it = m_offers.find (key);
+  if (it != m_offers.end ())
+    {
+      it->second.m_event.Cancel ();
+      it->second.m_entry = QueueEntry ();
+    }
+}
+
+// Acknowledge a data packet to the neighbor that handed it to us
+void
+RoutingProtocol::DataReplyAck (Ipv4Address neighbor, const Ipv4Header & header)
+{
+  DataAckHeader ackHeader (header.GetSource (), header.GetIdentification ());
+  for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j = m_socketAddress.begin ();
+       j != m_socketAddress.end (); ++j)
+    {
+      Ipv4InterfaceAddress iface = j->second;
+      if (!iface.GetMask ().IsMatch (iface.GetLocal (), neighbor))
+        {
+          continue;
+        }
+      Ptr<Packet> packet = Create<Packet> ();
+      packet->AddHeader (ackHeader);
+      TypeHeader tHeader (CARPTYPE_DATA_ACK);
+      packet->AddHeader (tHeader);
+      SendTo (j->first, packet, neighbor);
+      return;
+    }
+}
+
+// Stamp this hop on a data packet and hand it to a relay, watching for its DATA_ACK
+void
+RoutingProtocol::SendToRelay (Ptr<Ipv4Route> route, Ptr<const Packet> p, const Ipv4Header & header,
+                              UnicastForwardCallback ucb, ErrorCallback ecb)
+{
+  Ptr<Packet> packet = p->Copy ();
+  DeferredRouteOutputTag deferred;
+  packet->RemovePacketTag (deferred);
+  StampHop (packet, route, !m_dataAckTimeout.IsZero ());
+  if (!m_dataAckTimeout.IsZero ())
+    {
+      WatchDataAck (packet, header, route->GetGateway (), ucb, ecb);
+    }
+  ucb (route, packet, header);
+}
+
+// Name this node as the previous hop of a data packet sent over route
+void
+RoutingProtocol::StampHop (Ptr<Packet> p, Ptr<Ipv4Route> route, bool ackRequested)
+{
+  HopTag hop;
+  p->RemovePacketTag (hop);
+  p->AddPacketTag (HopTag (route->GetSource (), ackRequested));
+}
+
+void
+RoutingProtocol::WatchDataAck (Ptr<const Packet> p, const Ipv4Header & header, Ipv4Address relay,
+                               UnicastForwardCallback ucb, ErrorCallback ecb)
+{
+  Time now = Simulator::Now ();
+  for (std::map<uint64_t, HopAck>::iterator i = m_hopAcks.begin (); i != m_hopAcks.end (); )
+    {
+      if (i->second.m_expire < now && !i->second.m_timeout.IsRunning ())
+        {
+          m_hopAcks.erase (i++);
+        }
+      else
+        {
+          ++i;
+        }
+    }
+  // A resent packet keeps its entry, and with it the count of relays that failed it
+  HopAck &pending = m_hopAcks[PacketKey (header)];
+  pending.m_timeout.Cancel ();
+  pending.m_entry = QueueEntry (p, header, ucb, ecb);
+  pending.m_relay = relay;
+  pending.m_expire = now + m_dataAckTimeout + GetMaxQueueTime ();
+  pending.m_timeout = Simulator::Schedule (m_dataAckTimeout, &RoutingProtocol::DataAckExpire, this,
+                                           PacketKey (header));
+}
+
+void
+RoutingProtocol::DataAckExpire (uint64_t key)
+{
+  std::map<uint64_t, HopAck>::iterator it = m_hopAcks.find (key);
+  if (it == m_hopAcks.end ())
+    {
+      return;
+    }
+  QueueEntry entry = it->second.m_entry;
+  it->second.m_entry = QueueEntry ();
+  NS_LOG_LOGIC ("No DATA_ACK from " << it->second.m_relay << " for " << entry.GetPacket ()->GetUid ());
+  RelayFailed (it->second.m_relay);
+  if (++it->second.m_resends > m_maxDataAckRetries)
+    {
+      m_hopAcks.erase (it);
+      NS_LOG_LOGIC ("Packet " << entry.GetPacket ()->GetUid () << " unacknowledged by "
+                    << m_maxDataAckRetries + 1 << " relays, dropping");
+      entry.GetErrorCallback () (entry.GetPacket (), entry.GetIpv4Header (), Socket::ERROR_NOROUTETOHOST);
+      return;
+    }
+  // The next ranked relay, else a new handshake
+  SendUplink (entry.GetPacket (), entry.GetIpv4Header (), entry.GetUnicastForwardCallback (),
+              entry.GetErrorCallback ());
+}
+
+uint64_t
+RoutingProtocol::PacketKey (const Ipv4Header & header)
+{
+  return ((uint64_t) header.GetSource ().Get () << 16) | header.GetIdentification ();
+}
+
+bool
+RoutingProtocol::IsBroadcast (Ipv4Address dst) const
+{
+  if (dst.IsBroadcast ())
+    {
+      return true;
+    }
+  for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j = m_socketAddress.begin ();
+       j != m_socketAddress.end (); ++j)
+    {
+      if (dst == j->second.GetBroadcast ())
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
+Ptr<Ipv4Route>
+RoutingProtocol::BroadcastRoute (Ipv4Address dst, Ptr<NetDevice> oif) const
+{
+  for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j = m_socketAddress.begin ();
+       j != m_socketAddress.end (); ++j)
+    {
+      Ipv4Address addr = j->second.GetLocal ();
+      Ptr<NetDevice> dev = m_ipv4->GetNetDevice (m_ipv4->GetInterfaceForAddress (addr));
+      if (oif && oif != dev)
+        {
+          continue;
+        }
+      Ptr<Ipv4Route> route = Create<Ipv4Route> ();
+      route->SetDestination (dst);
+      route->SetGateway (dst);
+      route->SetSource (addr);
+      route->SetOutputDevice (dev);
+      return route;
+    }
+  return Ptr<Ipv4Route> ();
+}
+
+/*
+ * Counter-based suppression along the gradient: the first copy is delivered and a
+ * rebroadcast is scheduled after a random assessment delay, but only by nodes that
+ * have a neighbor farther from the sink. Every further copy heard during the delay
+ * counts against it; at BroadcastCounterThreshold copies the neighborhood is
+ * considered covered and the rebroadcast is cancelled. It also only goes out if a
+ * copy came from a neighbor closer to the sink, the sink itself included.
+ */
+void
+RoutingProtocol::RecvBroadcastData (Ptr<const Packet> p, const Ipv4Header & header, UnicastForwardCallback ucb,
+                                    LocalDeliverCallback lcb, int32_t iif)
+{
+  Time now = Simulator::Now ();
+  for (std::map<uint64_t, Dissemination>::iterator i = m_dissemination.begin (); i != m_dissemination.end (); )
+    {
+      if (i->second.m_expire < now)
+        {
+          m_dissemination.erase (i++);
+        }
+      else
+        {
+          ++i;
+        }
+    }
+
+  uint64_t key = PacketKey (header);
+  std::map<uint64_t, Dissemination>::iterator it = m_dissemination.find (key);
+  if (it != m_dissemination.end () && it->second.m_copies > 0)
+    {
+      it->second.m_copies++;
+      if (it->second.m_copies >= m_broadcastThreshold && it->second.m_rebroadcast.IsRunning ())
+        {
+          NS_LOG_LOGIC ("Suppress rebroadcast of " << p->GetUid () << " after " << it->second.m_copies << " copies");
+          it->second.m_rebroadcast.Cancel ();
+        }
+      return;
+    }
+
+  if (!lcb.IsNull ())
+    {
+      NS_LOG_LOGIC ("Broadcast local delivery of " << p->GetUid ());
+      lcb (p, header, iif);
+    }
+  // The entry may exist already if the link-layer sender of this copy was seen first
+  Dissemination &entry = m_dissemination[key];
+  entry.m_packet = p;
+  entry.m_header = header;
+  entry.m_ucb = ucb;
+  entry.m_iif = iif;
+  entry.m_copies = 1;
+  entry.m_expire = now + m_broadcastJitter + m_relayLifetime;
+  if (m_enableBroadcast && header.GetTtl () > 1 && m_hopCount != std::numeric_limits<uint32_t>::max ()
+      && m_nb.HasOutwardNeighbor (m_hopCount))
+    {
+      Time delay = Seconds (m_uniformRandomVariable->GetValue (0, m_broadcastJitter.GetSeconds ()));
+      entry.m_rebroadcast = Simulator::Schedule (delay, &RoutingProtocol::Rebroadcast, this, key);
+    }
+}
+
+// IP keeps the origin as source, so the neighbor that relayed a copy is only known from the frame
+void
+RoutingProtocol::NoteBroadcastSender (const Ipv4Header & header, const Address &from)
+{
+  Ipv4Address prevHop = m_nb.GetAddress (from);
+  if (prevHop == Ipv4Address () || m_nb.GetHopCount (prevHop) >= m_hopCount)
+    {
+      return;
+    }
+  Dissemination &entry = m_dissemination[PacketKey (header)];
+  if (entry.m_copies == 0)
+    {
+      entry.m_expire = Simulator::Now () + m_broadcastJitter + m_relayLifetime;
+    }
+  entry.m_inward = true;
+}
+
+void
+RoutingProtocol::Rebroadcast (uint64_t key)
+{
+  std::map<uint64_t, Dissemination>::const_iterator it = m_dissemination.find (key);
+  if (it == m_dissemination.end ())
+    {
+      return;
+    }
+  const Dissemination &entry = it->second;
+  if (!entry.m_inward)
+    {
+      // Copies relayed sideways or inward would flood back towards the sink
+      NS_LOG_LOGIC ("Broadcast " << entry.m_packet->GetUid () << " not heard from an inward neighbor");
+      return;
+    }
+  Ptr<Ipv4Route> route = BroadcastRoute (entry.m_header.GetDestination (), m_ipv4->GetNetDevice (entry.m_iif));
+  if (route == 0)
+    {
+      return;
+    }
+  NS_LOG_LOGIC ("Rebroadcast " << entry.m_packet->GetUid () << " at hop " << m_hopCount);
+  UnicastForwardCallback ucb = entry.m_ucb;
+  ucb (route, entry.m_packet, entry.m_header);
+}
+
+// Method to initiate PING, PONG, PACKET FORWARDING
+Ptr<Ipv4Route>
+RoutingProtocol::RouteOutput (Ptr<Packet> p, const Ipv4Header &header, Ptr<NetDevice> oif, Socket::SocketErrno &sockerr)
 {
   // Condition if no defined packet 
   
   // Condition if socket address is empty 
-  if (m_socketAddresses.empty ())
+  if (m_socketAddress.empty ())
+  {
+   sockerr = Socket::ERROR_NOROUTETOHOST;
+   Ptr<Ipv4Route> route;
+   return route;
+  }
+  Ipv4Address dst = header.GetDestination ();
+  if (IsBroadcast (dst))
+  {
+    // Dissemination needs no relay, receivers decide whether to carry it further out
+    sockerr = Socket::ERROR_NOTERROR;
+    return BroadcastRoute (dst, oif);
+  }
+  // CARP control and traffic for a live neighbor take the direct link, never a relay
+  if (IsControl (p, header) || (m_nb.IsNeighbor (dst) && m_nb.GetExpireTime (dst) > Seconds (0)))
+  {
+    Ptr<Ipv4Route> route = NeighborRoute (dst, dst);
+    if (route)
+    {
+      sockerr = Socket::ERROR_NOTERROR;
+      ClassSent (p, PriorityTag::Classify (p, header), Seconds (0));
+      return route;
+    }
+  }
+  Ipv4Address relay;
+  if (GetReversePath (dst, relay))
   {
-   sockerr = Socket::ERROR_NOROUTETOHOST;
-   Ptr<Ipv4Route> route;
-   return route;
+    Ptr<Ipv4Route> route = NeighborRoute (dst, relay);
+    if (route)
+    {
+      sockerr = Socket::ERROR_NOTERROR;
+      StampHop (p, route, false);
+      return route;
+    }
+  }
+  TrafficClass trafficClass = PriorityTag::Classify (p, header);
+  // A packet waiting for its DATA_ACK needs a forward callback to be resent, so it takes the loopback
+  while (m_dataAckTimeout.IsZero () && GetRelay (relay, trafficClass))
+  {
+    Ptr<Ipv4Route> route = NeighborRoute (dst, relay);
+    if (route)
+    {
+      sockerr = Socket::ERROR_NOTERROR;
+      ClassSent (p, trafficClass, Seconds (0));
+      StampHop (p, route, false);
+      return route;
+    }
+    RelayFailed (relay);
   }
-  // sockerr = Socket::ERROR_NOTERROR; // Not sure what this is meant for
-  Ipv4Address dst = header.GetDestination ();
 
-  // Invoke Ping, Pong, Relay Selection & Route Returned
+  // Invoke Ping, Pong, Relay Selection & Route Returned. The packet loops back into
+  // RouteInput and waits in the handshake buffer until a relay is chosen.
+  sockerr = Socket::ERROR_NOTERROR;
+  uint32_t iif = (oif ? m_ipv4->GetInterfaceForDevice (oif) : -1);
+  DeferredRouteOutputTag tag (iif);
+  if (!p->PeekPacketTag (tag))
+  {
+    p->AddPacketTag (tag);
+  }
+  return LoopbackRoute (header, oif);
 }
 
 bool
 RoutingProtocol::RouteInput (Ptr<const Packet> p, const Ipv4Header &header,
 			     Ptr<const NetDevice> idev, UnicastForwardCallback ucb,
-			     LocalDeliverCallback lcb, ErrorCallback ecb)
-
+			     MulticastForwardCallback mcb, LocalDeliverCallback lcb,
+			     ErrorCallback ecb)
 {
  if (m_socketAddress.empty())
  {
@@ -200,15 +2196,58 @@ RoutingProtocol::RouteInput (Ptr<const Packet> p, const Ipv4Header &header,
  Ipv4Address dst = header.GetDestination ();
  Ipv4Address origin = header.GetSource ();
 
+ // Deferred route request
+ if (idev == m_lo)
+ {
+   DeferredRouteOutputTag tag;
+   if (p->PeekPacketTag (tag))
+   {
+     SendUplink (p, header, ucb, ecb);
+     return true;
+   }
+ }
+
+ // The hop tag is only meaningful on the link it was stamped for. The previous
+ // hop waits for our DATA_ACK before failing over to its next relay
+ HopTag hop;
+ if (ConstCast<Packet> (p)->RemovePacketTag (hop) && hop.IsAckRequested ())
+ {
+   DataReplyAck (hop.GetPrevHop (), header);
+ }
+ Ipv4Address prevHop = hop.GetPrevHop ();
+
  // Checks if duplicate packet is being sent 
  if (IsMyOwnAddress (origin) )
  {
   return true;
  }
 
+ // Broadcast data from the sink rides the hop gradient outward
+ if (IsBroadcast (dst))
+ {
+   UdpHeader udpHeader;
+   if (header.GetProtocol () == UdpL4Protocol::PROT_NUMBER && p->PeekHeader (udpHeader)
+       && udpHeader.GetDestinationPort () == CARP_PORT)
+   {
+     // CARP control is one hop only: local delivery, never disseminated
+     if (!lcb.IsNull ())
+     {
+       lcb (p, header, iif);
+     }
+     return true;
+   }
+   RecvBroadcastData (p, header, ucb, lcb, iif);
+   return true;
+ }
+
  // Unicast local delivery 
- if (m_ipv4->IsDestinationAddress (dst, iif)
+ if (m_ipv4->IsDestinationAddress (dst, iif))
  {
+   if (header.GetProtocol () == AGGREGATE_PROTOCOL)
+   {
+     Deaggregate (p, idev);
+     return true;
+   }
    if (lcb.IsNull () == false) // This delivers the packet to the node when the local callback is not null
    {
      NS_LOG_LOGIC ("Unicast local delivery to " << dst );
@@ -227,21 +2266,594 @@ RoutingProtocol::RouteInput (Ptr<const Packet> p, const Ipv4Header &header,
 
  /* Forward packet || This transmits the packet to the destination node once it is not meant for the local node ||
  It is important to define the PING, PONG & RELAY SELECTION in the forwarding method */
- return Forwarding (p, header, ucb, ecb);	
+ return Forwarding (p, header, prevHop, ucb, ecb);
  
 }
 
 bool
-RoutingProtocol::Forwarding (Ptr<const Packet> p, const Ipv4Header & header,
+RoutingProtocol::Forwarding (Ptr<const Packet> p, const Ipv4Header & header, Ipv4Address prevHop,
 			     UnicastForwardCallback ucb, ErrorCallback ecb)
 {
  Ipv4Address dst = header.GetDestination ();
  Ipv4Address origin = header.GetSource ();
 
- // Think about the logic for this
+ // Downlink packets retrace the uplink path of their destination
+ Ipv4Address relay;
+ if (GetReversePath (dst, relay))
+ {
+   Ptr<Ipv4Route> route = NeighborRoute (dst, relay);
+   if (route)
+   {
+     NS_LOG_LOGIC ("Downlink " << p->GetUid () << " to " << dst << " via " << relay);
+     Ptr<Packet> packet = p->Copy ();
+     StampHop (packet, route, false);
+     ucb (route, packet, header);
+     return true;
+   }
+ }
+ // A downlink packet whose path is gone would only climb back up the gradient and loop
+ if (m_hopCount == 0 || IsInwardNeighbor (prevHop))
+ {
+   NS_LOG_LOGIC ("No downlink path to " << dst << ", dropping " << p->GetUid ());
+   ecb (p, header, Socket::ERROR_NOROUTETOHOST);
+   return true;
+ }
+ // Routine uplink traffic may wait a little to share one frame with others
+ if (AddToAggregate (p, header, ucb, ecb))
+ {
+   return true;
+ }
+ NS_LOG_LOGIC ("Forwarding " << p->GetUid () << " from " << origin);
+ SendUplink (p, header, ucb, ecb);
+ return true;
+}
+
+bool
+RoutingProtocol::IsInwardNeighbor (Ipv4Address neighbor)
+{
+  if (neighbor == Ipv4Address () || m_hopCount == std::numeric_limits<uint32_t>::max ())
+    {
+      return false;
+    }
+  return m_nb.GetHopCount (neighbor) < m_hopCount;
+}
+
+void
+RoutingProtocol::SendUplink (Ptr<const Packet> p, const Ipv4Header & header,
+                             UnicastForwardCallback ucb, ErrorCallback ecb)
+{
+  // Fail over through the ranked backups before paying for a new handshake
+  Ipv4Address relay;
+  TrafficClass trafficClass = PriorityTag::Classify (p, header);
+  while (GetRelay (relay, trafficClass))
+    {
+      Ptr<Ipv4Route> route = NeighborRoute (header.GetDestination (), relay);
+      if (route)
+        {
+          ClassSent (p, trafficClass, Seconds (0));
+          SendToRelay (route, p, header, ucb, ecb);
+          return;
+        }
+      RelayFailed (relay);
+    }
+  // Hold the packet until the handshake picks a relay
+  DeferredRouteOutput (p, header, ucb, ecb);
+}
+
+/*
+ * In-network aggregation. A relay holds routine packets to the same
+ * destination for at most AggregationDelay and sends them as one IP packet of
+ * protocol AGGREGATE_PROTOCOL: an AggregateHeader followed by the original
+ * packets, IP headers included. Aggregates are forwarded as they are, and the
+ * destination re-injects the original packets into its IP stack, so they are
+ * delivered as if they had travelled on their own. Packet tags ride along as
+ * byte tags spanning their packet. An aggregate is only built when a relay is
+ * known; otherwise every packet waits for the handshake on its own.
+ */
+bool
+RoutingProtocol::AddToAggregate (Ptr<const Packet> p, const Ipv4Header & header,
+                                 UnicastForwardCallback ucb, ErrorCallback ecb)
+{
+  uint32_t size = p->GetSize () + header.GetSerializedSize ();
+  Ipv4Header outer;
+  uint32_t overhead = outer.GetSerializedSize () + 1 + 2 * 2; // Aggregate of two packets at least
+  if (m_aggregationDelay.IsZero () || header.GetProtocol () == AGGREGATE_PROTOCOL
+      || PriorityTag::Classify (p, header) != CLASS_ROUTINE || size + overhead > m_aggregationMaxSize)
+    {
+      return false;
+    }
+  Ipv4Address dst = header.GetDestination ();
+  std::map<Ipv4Address, Aggregate>::iterator it = m_aggregates.find (dst);
+  if (it != m_aggregates.end ())
+    {
+      const Aggregate &agg = it->second;
+      uint32_t grown = outer.GetSerializedSize () + agg.m_header.GetSerializedSize () + 2
+        + agg.m_payload->GetSize () + size;
+      if (grown > m_aggregationMaxSize || agg.m_header.GetNPackets () == 255)
+        {
+          FlushAggregate (dst);
+          it = m_aggregates.end ();
+        }
+    }
+  if (it == m_aggregates.end ())
+    {
+      Aggregate agg;
+      agg.m_payload = Create<Packet> ();
+      agg.m_flush = Simulator::Schedule (m_aggregationDelay, &RoutingProtocol::FlushAggregate, this, dst);
+      it = m_aggregates.insert (std::make_pair (dst, agg)).first;
+    }
+
+  Ptr<Packet> inner = p->Copy ();
+  DeferredRouteOutputTag tag;
+  inner->RemovePacketTag (tag);
+  Ipv4Header innerHeader = header;
+  if (Node::ChecksumEnabled ())
+    {
+      innerHeader.EnableChecksum ();
+    }
+  inner->AddHeader (innerHeader);
+  // AddAtEnd keeps byte tags only; Deaggregate turns these back into packet tags
+  PacketTagIterator tags = inner->GetPacketTagIterator ();
+  while (tags.HasNext ())
+    {
+      PacketTagIterator::Item item = tags.Next ();
+      Tag *t = CreateTag (item.GetTypeId ());
+      if (t == 0)
+        {
+          continue;
+        }
+      item.GetTag (*t);
+      inner->AddByteTag (*t);
+      delete t;
+    }
+  it->second.m_payload->AddAtEnd (inner);
+  it->second.m_header.AddPacket (inner->GetSize ());
+  it->second.m_packets.push_back (QueueEntry (p, header, ucb, ecb));
+  NS_LOG_LOGIC ("Aggregate " << p->GetUid () << " towards " << dst << ", "
+                << it->second.m_header.GetNPackets () << " packets held");
+  return true;
+}
+
+// A default instance of a tag type, 0 if it cannot be built
+Tag *
+RoutingProtocol::CreateTag (TypeId tid)
+{
+  if (!tid.HasConstructor () || tid.GetConstructor ().IsNull ())
+    {
+      return 0;
+    }
+  ObjectBase *instance = tid.GetConstructor () ();
+  Tag *tag = dynamic_cast<Tag *> (instance);
+  if (tag == 0)
+    {
+      delete instance;
+    }
+  return tag;
+}
+
+void
+RoutingProtocol::FlushAggregate (Ipv4Address dst)
+{
+  std::map<Ipv4Address, Aggregate>::iterator it = m_aggregates.find (dst);
+  if (it == m_aggregates.end ())
+    {
+      return;
+    }
+  Aggregate agg = it->second;
+  m_aggregates.erase (it);
+  agg.m_flush.Cancel ();
+
+  Ipv4Address relay;
+  Ptr<Ipv4Route> route;
+  while (agg.m_packets.size () > 1 && route == 0 && GetRelay (relay))
+    {
+      route = NeighborRoute (dst, relay);
+      if (route == 0)
+        {
+          RelayFailed (relay);
+        }
+    }
+  if (route == 0)
+    {
+      // Nothing joined the first packet, or it would wait for a handshake anyway
+      for (std::vector<QueueEntry>::const_iterator i = agg.m_packets.begin (); i != agg.m_packets.end (); ++i)
+        {
+          SendUplink (i->GetPacket (), i->GetIpv4Header (), i->GetUnicastForwardCallback (), i->GetErrorCallback ());
+        }
+      return;
+    }
+
+  Ptr<Packet> packet = agg.m_payload->Copy ();
+  packet->AddHeader (agg.m_header);
+  Ipv4Header header;
+  header.SetSource (route->GetSource ());
+  header.SetDestination (dst);
+  header.SetProtocol (AGGREGATE_PROTOCOL);
+  header.SetTtl (64);
+  header.SetIdentification (m_aggregateId++);
+  header.SetPayloadSize (packet->GetSize ());
+  if (Node::ChecksumEnabled ())
+    {
+      header.EnableChecksum ();
+    }
+  NS_LOG_LOGIC ("Send aggregate of " << agg.m_header.GetNPackets () << " packets, "
+                << packet->GetSize () << " bytes, towards " << dst << " via " << relay);
+  for (std::vector<QueueEntry>::const_iterator i = agg.m_packets.begin (); i != agg.m_packets.end (); ++i)
+    {
+      ClassSent (i->GetPacket (), CLASS_ROUTINE, i->GetHoldTime ());
+    }
+  SendToRelay (route, packet, header, agg.m_packets.front ().GetUnicastForwardCallback (),
+               agg.m_packets.front ().GetErrorCallback ());
+}
+
+void
+RoutingProtocol::Deaggregate (Ptr<const Packet> p, Ptr<const NetDevice> idev)
+{
+  Ptr<Packet> packet = p->Copy ();
+  AggregateHeader aggHeader;
+  packet->RemoveHeader (aggHeader);
+  Ptr<Ipv4L3Protocol> l3 = m_ipv4->GetObject<Ipv4L3Protocol> ();
+  uint32_t offset = 0;
+  for (uint32_t i = 0; i < aggHeader.GetNPackets (); ++i)
+    {
+      uint16_t size = aggHeader.GetPacketSize (i);
+      if (offset + size > packet->GetSize ())
+        {
+          NS_LOG_DEBUG ("Truncated aggregate " << p->GetUid ());
+          return;
+        }
+      Ptr<Packet> inner = packet->CreateFragment (offset, size);
+      offset += size;
+      // The fragment inherits the aggregate's packet tags; only its own belong to it
+      inner->RemoveAllPacketTags ();
+      // Byte tags spanning the whole packet were its packet tags before aggregation
+      ByteTagIterator tags = inner->GetByteTagIterator ();
+      while (tags.HasNext ())
+        {
+          ByteTagIterator::Item item = tags.Next ();
+          if (item.GetStart () != 0 || item.GetEnd () != size)
+            {
+              continue;
+            }
+          Tag *t = CreateTag (item.GetTypeId ());
+          if (t == 0)
+            {
+              continue;
+            }
+          item.GetTag (*t);
+          inner->ReplacePacketTag (*t);
+          delete t;
+        }
+      // The carrier byte tags have done their job
+      inner->RemoveAllByteTags ();
+      l3->Receive (ConstCast<NetDevice> (idev), inner, Ipv4L3Protocol::PROT_NUMBER,
+                   Address (), Address (), NetDevice::PACKET_HOST);
+    }
+}
+
+
+void
+RoutingProtocol::SetIpv4 (Ptr<Ipv4> ipv4)
+{
+  NS_ASSERT (ipv4 != 0);
+  NS_ASSERT (m_ipv4 == 0);
+  m_ipv4 = ipv4;
+  // The loopback interface is created first, so it is always interface 0
+  NS_ASSERT (m_ipv4->GetNInterfaces () == 1
+             && m_ipv4->GetAddress (0, 0).GetLocal () == Ipv4Address ("127.0.0.1"));
+  m_lo = m_ipv4->GetNetDevice (0);
+  NS_ASSERT (m_lo != 0);
+  if (m_compact)
+    {
+      m_nb.SetCompact (m_compactLimit);
+    }
+  m_nb.Reserve (m_compact ? std::min (m_expectedNeighbors, m_compactLimit) : m_expectedNeighbors);
+}
+
+// Interfaces are up by now, and IsSink may have been set after they came up
+void
+RoutingProtocol::DoInitialize (void)
+{
+  if (m_isSink)
+    {
+      m_hopCount = 0;
+      m_helloTimer.Schedule (MilliSeconds (m_uniformRandomVariable->GetInteger (0, 10)));
+    }
+  Ipv4RoutingProtocol::DoInitialize ();
+}
+
+void
+RoutingProtocol::NotifyInterfaceUp (uint32_t i)
+{
+  Ptr<Ipv4L3Protocol> l3 = m_ipv4->GetObject<Ipv4L3Protocol> ();
+  if (l3->GetNAddresses (i) == 0)
+    {
+      return; // NotifyAddAddress opens the socket once the interface has an address
+    }
+  Ipv4InterfaceAddress iface = l3->GetAddress (i, 0);
+  if (iface.GetLocal () == Ipv4Address ("127.0.0.1"))
+    {
+      return;
+    }
+  OpenSocket (i, iface);
+
+  Ptr<NetDevice> dev = m_ipv4->GetNetDevice (i);
+  Ptr<ArpCache> arp = l3->GetInterface (i)->GetArpCache ();
+  if (arp)
+    {
+      m_nb.AddArpCache (arp);
+    }
+  // Devices without ARP (UAN) need the learned addresses most: PHY samples are matched on them
+  GetObject<Node> ()->RegisterProtocolHandler (MakeCallback (&RoutingProtocol::ReceiveFromDevice, this),
+                                               Ipv4L3Protocol::PROT_NUMBER, dev, false);
+  ConnectPhyTraces (dev);
+}
+
+void
+RoutingProtocol::NotifyInterfaceDown (uint32_t i)
+{
+  Ptr<Ipv4L3Protocol> l3 = m_ipv4->GetObject<Ipv4L3Protocol> ();
+  if (l3->GetNAddresses (i) > 0)
+    {
+      CloseSocket (l3->GetAddress (i, 0));
+    }
+  Ptr<ArpCache> arp = l3->GetInterface (i)->GetArpCache ();
+  if (arp)
+    {
+      m_nb.DelArpCache (arp);
+    }
+  if (m_socketAddress.empty ())
+    {
+      NS_LOG_LOGIC ("No CARP interfaces left");
+      m_pingTimer.Cancel ();
+      m_backoffTimer.Cancel ();
+      m_helloTimer.Cancel ();
+      m_helloForwardTimer.Cancel ();
+      m_relays.clear ();
+    }
+}
+
+// CARP runs on the first address of an interface only
+void
+RoutingProtocol::NotifyAddAddress (uint32_t i, Ipv4InterfaceAddress address)
+{
+  Ptr<Ipv4L3Protocol> l3 = m_ipv4->GetObject<Ipv4L3Protocol> ();
+  if (!l3->IsUp (i) || l3->GetNAddresses (i) != 1 || address.GetLocal () == Ipv4Address ("127.0.0.1"))
+    {
+      return;
+    }
+  if (FindSocketWithInterfaceAddress (address) == 0)
+    {
+      OpenSocket (i, address);
+    }
+}
+
+void
+RoutingProtocol::NotifyRemoveAddress (uint32_t i, Ipv4InterfaceAddress address)
+{
+  if (FindSocketWithInterfaceAddress (address) == 0)
+    {
+      return;
+    }
+  CloseSocket (address);
+  Ptr<Ipv4L3Protocol> l3 = m_ipv4->GetObject<Ipv4L3Protocol> ();
+  if (l3->IsUp (i) && l3->GetNAddresses (i) > 0)
+    {
+      // Move to the address now first on the interface
+      OpenSocket (i, l3->GetAddress (i, 0));
+    }
+}
+
+// Create a socket to listen only on interface i, bound to its address iface
+void
+RoutingProtocol::OpenSocket (uint32_t i, Ipv4InterfaceAddress iface)
+{
+  Ptr<Socket> socket = Socket::CreateSocket (GetObject<Node> (), UdpSocketFactory::GetTypeId ());
+  NS_ASSERT (socket != 0);
+  socket->BindToNetDevice (m_ipv4->GetNetDevice (i));
+  socket->Bind (InetSocketAddress (iface.GetLocal (), CARP_PORT));
+  socket->SetAllowBroadcast (true);
+  socket->SetRecvCallback (MakeCallback (&RoutingProtocol::RecvCarp, this));
+  m_socketAddress.insert (std::make_pair (socket, iface));
+}
+
+void
+RoutingProtocol::CloseSocket (Ipv4InterfaceAddress iface)
+{
+  Ptr<Socket> socket = FindSocketWithInterfaceAddress (iface);
+  if (socket == 0)
+    {
+      return;
+    }
+  socket->Close ();
+  m_socketAddress.erase (socket);
+}
+
+Ptr<Socket>
+RoutingProtocol::FindSocketWithInterfaceAddress (Ipv4InterfaceAddress addr) const
+{
+  for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j = m_socketAddress.begin ();
+       j != m_socketAddress.end (); ++j)
+    {
+      if (j->second == addr)
+        {
+          return j->first;
+        }
+    }
+  return Ptr<Socket> ();
+}
+
+void
+RoutingProtocol::PrintRoutingTable (Ptr<OutputStreamWrapper> stream, Time::Unit unit) const
+{
+  std::ostream *os = stream->GetStream ();
+  *os << "Node: " << m_ipv4->GetObject<Node> ()->GetId ()
+      << "; Time: " << Now ().As (unit)
+      << ", Local time: " << GetObject<Node> ()->GetLocalTime ().As (unit)
+      << ", CARP Routing table" << std::endl;
+  *os << "Hop count: ";
+  if (m_hopCount == std::numeric_limits<uint32_t>::max ())
+    {
+      *os << "unknown";
+    }
+  else
+    {
+      *os << m_hopCount;
+    }
+  *os << " (round " << m_helloRound << ")" << std::endl;
+  *os << "Relays, best first (ranked at " << m_relaysSelected.As (unit) << "):" << std::endl;
+  for (std::vector<RelayCandidate>::const_iterator i = m_relays.begin (); i != m_relays.end (); ++i)
+    {
+      *os << "\t" << i->m_address << "\thops " << (uint32_t) i->m_hopCount
+          << "\tscore " << i->m_score << std::endl;
+    }
+  *os << "Reverse paths:" << std::endl;
+  for (std::map<Ipv4Address, ReversePath>::const_iterator i = m_reversePaths.begin (); i != m_reversePaths.end (); ++i)
+    {
+      *os << "\t" << i->first << "\tvia " << i->second.m_nextHop
+          << "\texpires " << (i->second.m_expire - Now ()).As (unit) << std::endl;
+    }
+  *os << std::endl;
+}
+
+// Subscribe to the receive side of the PHY so that every overheard frame refreshes the link estimate
+void
+RoutingProtocol::ConnectPhyTraces (Ptr<NetDevice> dev)
+{
+  m_nb.SetLinkQualityParameters (m_lqAlpha, m_snrMax);
+  Ptr<WifiNetDevice> wifi = DynamicCast<WifiNetDevice> (dev);
+  if (wifi)
+    {
+      wifi->GetPhy ()->TraceConnectWithoutContext ("MonitorSnifferRx",
+                                                   MakeCallback (&RoutingProtocol::WifiSnifferRx, this));
+      wifi->GetRemoteStationManager ()->TraceConnectWithoutContext ("MacTxFinalDataFailed",
+                                                                    MakeCallback (&RoutingProtocol::MacTxFailed, this));
+      return;
+    }
+  Ptr<UanNetDevice> uan = DynamicCast<UanNetDevice> (dev);
+  if (uan)
+    {
+      uan->GetPhy ()->TraceConnectWithoutContext ("RxOk", MakeCallback (&RoutingProtocol::UanPhyRxOk, this));
+      return;
+    }
+  Ptr<LinkNetDevice> link = DynamicCast<LinkNetDevice> (dev);
+  if (link)
+    {
+      link->TraceConnectWithoutContext ("RxOk", MakeCallback (&RoutingProtocol::LinkRxOk, this));
+      link->TraceConnectWithoutContext ("TxFailed", MakeCallback (&RoutingProtocol::MacTxFailed, this));
+      return;
+    }
+  NS_LOG_LOGIC ("No PHY link quality source on device " << dev->GetIfIndex ());
+}
+
+void
+RoutingProtocol::WifiSnifferRx (Ptr<const Packet> packet, uint16_t channelFreqMhz, WifiTxVector txVector,
+                                MpduInfo aMpdu, SignalNoiseDbm signalNoise)
+{
+  WifiMacHeader hdr;
+  if (packet->PeekHeader (hdr) == 0 || !hdr.IsData ())
+    {
+      return; // Control frames carry no transmitter we can attribute
+    }
+  m_nb.UpdateLinkQuality (hdr.GetAddr2 (), signalNoise.signal - signalNoise.noise, true);
+}
+
+void
+RoutingProtocol::UanPhyRxOk (Ptr<const Packet> packet, double sinr, UanTxMode mode)
+{
+  UanHeaderCommon hdr;
+  if (packet->PeekHeader (hdr) == 0)
+    {
+      return;
+    }
+  m_nb.UpdateLinkQuality (hdr.GetSrc (), sinr, true);
+}
+
+// Only CARP control frames are trusted to bind an IP address to the link-layer sender
+void
+RoutingProtocol::ReceiveFromDevice (Ptr<NetDevice> device, Ptr<const Packet> packet, uint16_t protocol,
+                                    const Address &from, const Address &to, NetDevice::PacketType packetType)
+{
+  Ptr<Packet> copy = packet->Copy ();
+  Ipv4Header ipHeader;
+  copy->RemoveHeader (ipHeader);
+  if (IsMyOwnAddress (ipHeader.GetSource ()))
+    {
+      return;
+    }
+  if (ipHeader.GetProtocol () == UdpL4Protocol::PROT_NUMBER)
+    {
+      UdpHeader udpHeader;
+      copy->RemoveHeader (udpHeader);
+      if (udpHeader.GetDestinationPort () == CARP_PORT)
+        {
+          TypeHeader tHeader;
+          copy->PeekHeader (tHeader);
+          if (tHeader.IsValid ())
+            {
+              m_nb.LearnHardwareAddress (ipHeader.GetSource (), from, device);
+            }
+          return;
+        }
+    }
+  if (IsBroadcast (ipHeader.GetDestination ()))
+    {
+      NoteBroadcastSender (ipHeader, from);
+      return;
+    }
+  // Unicast data handed to us by a neighbor: that neighbor is the way back to the origin
+  if (packetType == NetDevice::PACKET_HOST && !IsBroadcast (ipHeader.GetDestination ()))
+    {
+      Ipv4Address prevHop = m_nb.GetAddress (from);
+      if (prevHop != Ipv4Address ())
+        {
+          LearnReversePath (ipHeader.GetSource (), prevHop);
+          if (ipHeader.GetProtocol () == AGGREGATE_PROTOCOL)
+            {
+              AggregateHeader aggHeader;
+              copy->RemoveHeader (aggHeader);
+              for (uint32_t i = 0; i < aggHeader.GetNPackets () && copy->GetSize () > 0; ++i)
+                {
+                  Ipv4Header inner;
+                  copy->PeekHeader (inner);
+                  LearnReversePath (inner.GetSource (), prevHop);
+                  copy->RemoveAtStart (std::min<uint32_t> (aggHeader.GetPacketSize (i), copy->GetSize ()));
+                }
+            }
+        }
+    }
+}
 
+// The link channel knows the quality outright; scale it so the SNR term of the estimate reproduces it
+void
+RoutingProtocol::LinkRxOk (Ptr<const Packet> packet, Mac48Address from, double quality)
+{
+  m_nb.UpdateLinkQuality (from, quality * m_snrMax, true);
 }
 
+void
+RoutingProtocol::MacTxFailed (Mac48Address address)
+{
+  m_nb.UpdateLinkQuality (address, 0.0, false);
+  Ipv4Address neighbor = m_nb.GetAddress (address);
+  if (neighbor == Ipv4Address ())
+    {
+      return;
+    }
+  RelayFailed (neighbor);
+  // Downlink through the neighbor is broken too; the next uplink packet relearns a path
+  for (std::map<Ipv4Address, ReversePath>::iterator i = m_reversePaths.begin (); i != m_reversePaths.end (); )
+    {
+      if (i->second.m_nextHop == neighbor)
+        {
+          m_reversePaths.erase (i++);
+        }
+      else
+        {
+          ++i;
+        }
+    }
+}
 
 } // End of carp namespace
 } // End of ns3 namespace
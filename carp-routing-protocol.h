@@ -1,5 +1,8 @@
 /* This header file defines essential parameters used in developing the Channel-aware routing protocol core module*/
 
+#ifndef CARP_ROUTING_PROTOCOL_H
+#define CARP_ROUTING_PROTOCOL_H
+
 #include "ns3/ipv4-routing-protocol.h"
 #include "ns3/node.h"
 #include "ns3/ipv4-interface.h"
@@ -8,11 +11,19 @@
 #include "ns3/output-stream-wrapper.h"
 #include "ns3/random-variable-stream.h"
 #include <vector>
+#include <limits>
 #include "ns3/simulator.h"
 #include "ns3/timer.h"
 #include "ns3/ipv4-address.h"
 #include "ns3/callback.h"
 #include "ns3/arp-cache.h"
+#include "ns3/carp-header.h"
+#include "ns3/carp-packet-queue.h"
+#include "ns3/carp-running-stats.h"
+#include "ns3/traced-callback.h"
+#include "ns3/wifi-phy.h"
+#include "ns3/uan-tx-mode.h"
+#include "ns3/vector.h"
 
 
 
@@ -21,25 +32,283 @@ namespace ns3{
 
 namespace carp {
 
+class Neighbors
+
+{
+
+public:
+
+  /**
+
+   * constructor
+
+   * \param delay the delay time for purging the list of neighbors
+
+   */
+
+  Neighbors (Time delay);
+
+  /// Neighbor description
+  struct Neighbor
+  {
+    /// Neighbor IPv4 address
+    Ipv4Address m_neighborAddress;
+    /// Neighbor MAC address (48 bit for Wifi, 8 bit for UAN)
+    Address m_hardwareAddress;
+    /// Neighbor expire time
+    Time m_expireTime;
+    bool close; // Not sure if this is needed for this scenario
+    /// EWMA of the SNR (dB) of frames received from this neighbor
+    double m_snr;
+    /// EWMA of frame success (1 on reception, 0 on MAC tx failure)
+    double m_prr;
+    /// True once the first PHY sample has seeded the averages
+    bool m_lqValid;
+    /// Last position advertised by the neighbor in a HELLO
+    Vector m_position;
+    bool m_hasPosition;
+    /// Neighbor hop count to the sink from its HELLO or PONG, UINT32_MAX if unknown
+    uint32_t m_hopCount;
+
+    /**
+     * \brief Neighbor structure constructor
+     *
+     * \param ip Ipv4Address entry
+     * \param mac hardware address entry
+     * \param t Time expire time
+     */
+
+    Neighbor (Ipv4Address ip, Address mac, Time t)
+      : m_neighborAddress (ip),
+        m_hardwareAddress (mac),
+        m_expireTime (t),
+        close (false),
+        m_snr (0.0),
+        m_prr (1.0),
+        m_lqValid (false),
+        m_hasPosition (false),
+        m_hopCount (std::numeric_limits<uint32_t>::max ())
+    {
+    }
+  };
+
+  Time GetExpireTime (Ipv4Address addr);
+  /**
+   * \returns true if the node with IP address is a neighbor
+   */
+  bool IsNeighbor (Ipv4Address addr);
+  /**
+   * Update expire time for entry with address addr, if it exists, else add new entry
+   */
+  void Update (Ipv4Address addr, Time expire);
+  /**
+   * Fold one PHY sample into the link estimate of the neighbor owning mac.
+   * \param mac transmitter (or intended receiver) hardware address
+   * \param snr SNR of the frame in dB, ignored when success is false
+   * \param success false when the MAC gave up delivering a frame to mac
+   */
+  void UpdateLinkQuality (Address mac, double snr, bool success);
+  /**
+   * \returns the link quality in [0,1] towards addr, 0 if unknown
+   */
+  double GetLinkQuality (Ipv4Address addr);
+  /// \returns the number of neighbors that have not expired
+  uint32_t GetSize ();
+  /**
+   * \returns the IP address of the neighbor with hardware address mac, or Ipv4Address () if unknown
+   */
+  Ipv4Address GetAddress (Address mac);
+  /**
+   * Record the hardware address a CARP frame from addr was received from, and
+   * install it in the ARP cache of dev so no ARP exchange is needed for addr
+   */
+  void LearnHardwareAddress (Ipv4Address addr, Address mac, Ptr<NetDevice> dev);
+  /// Record the position advertised by neighbor addr
+  void SetPosition (Ipv4Address addr, Vector position);
+  /// Record the hop count to the sink advertised by neighbor addr
+  void SetHopCount (Ipv4Address addr, uint32_t hopCount);
+  /// \returns the hop count advertised by neighbor addr, UINT32_MAX if unknown
+  uint32_t GetHopCount (Ipv4Address addr);
+  /**
+   * \returns true if a live neighbor is farther from the sink than hopCount, or its distance is unknown
+   */
+  bool HasOutwardNeighbor (uint32_t hopCount);
+  /**
+   * \returns the neighbors that are at least minProgress metres closer to sink than self
+   */
+  std::vector<Ipv4Address> GetProgressCandidates (Vector self, Vector sink, double minProgress);
+  /// Set the EWMA weight of new samples and the SNR (dB) treated as a perfect channel
+  void SetLinkQualityParameters (double alpha, double snrMax)
+  {
+    m_lqAlpha = alpha;
+    m_snrMax = snrMax;
+  }
+  /// Pre-size the table for n neighbors
+  void Reserve (uint32_t n)
+  {
+    m_nb.reserve (n);
+    m_packed.reserve (n);
+  }
+  /**
+   * Store at most limit neighbors in packed 32 byte entries (quantized link
+   * estimates, millisecond expiry, float positions). When full, the entry that
+   * expires first is replaced. Must be called while the table is empty.
+   */
+  void SetCompact (uint32_t limit);
+  /// \returns the heap bytes held by the table
+  uint32_t GetMemoryUsage () const;
+  /// Add ARP cache to be used to resolve neighbor hardware addresses
+  void AddArpCache (Ptr<ArpCache> a);
+  /// Don't use given ARP cache any more (interface is down)
+  void DelArpCache (Ptr<ArpCache> a);
+
+private:
+  /// Packed form of Neighbor used in compact state mode
+  struct PackedNeighbor
+  {
+    uint32_t m_address; // IPv4 address
+    uint32_t m_expireMs; // Expire time in ms since the start of the simulation
+    float m_position[3];
+    uint8_t m_mac[6]; // Hardware address, up to 48 bits
+    uint8_t m_macType; // Address type, with m_macLen == 0 if unknown
+    uint8_t m_macLen;
+    uint8_t m_snr; // SNR in quarter dB
+    uint8_t m_prr; // Frame success ratio in 1/255
+    uint8_t m_hopCount; // 255 if unknown
+    uint8_t m_flags; // PACKED_* flags
+  };
+  enum
+  {
+    PACKED_LQ_VALID = 1,
+    PACKED_HAS_POSITION = 2,
+    PACKED_CLOSE = 4
+  };
+
+  // Entries are addressed by a small integer ID, their index in the table
+  uint32_t Count () const;
+  Neighbor Get (uint32_t id) const;
+  void Put (uint32_t id, const Neighbor &n);
+  int32_t Find (Ipv4Address addr) const;
+  int32_t FindByMac (Address mac) const;
+  void Append (const Neighbor &n);
+  static void Pack (const Neighbor &n, PackedNeighbor &p);
+  static void PackMac (Address mac, PackedNeighbor &p);
+
+  Timer m_ntimer;
+  std::vector<Neighbor>m_nb;
+  std::vector<PackedNeighbor> m_packed; // Used instead of m_nb in compact mode
+  std::map<Address, uint32_t> m_byMac; // Hardware address to entry ID in full mode; compact mode scans m_packed
+  bool m_compact;
+  uint32_t m_limit; // Maximum entries in compact mode
+  std::vector<Ptr<ArpCache> > m_arp; // ARP caches of the CARP interfaces
+  double m_lqAlpha; // Weight of the newest sample in the link EWMA
+  double m_snrMax;  // SNR (dB) at and above which the channel counts as perfect
+  Address LookupMacAddress (Ipv4Address addr);
+
+
+}; // End of class Neighbors
+
 class RoutingProtocol : public Ipv4RoutingProtocol
 {
 
 public:
  static TypeId GetTypeId (void);
  static const uint32_t CARP_PORT;
+ static const uint8_t AGGREGATE_PROTOCOL; // IP protocol of packets merged by a relay
  // Constructor
  RoutingProtocol ();
+ /// Copy the configuration of a prototype agent, with empty per-node state (see CarpHelper)
+ RoutingProtocol (const RoutingProtocol &o);
  virtual ~RoutingProtocol ();
 
  // Methods inherited from Ipv4RoutingProtocol
  Ptr<Ipv4Route> RouteOutput (Ptr<Packet> p, const Ipv4Header &header, Ptr<NetDevice> oif, Socket::SocketErrno &sockerr); 
  bool RouteInput (Ptr<const Packet> p, const Ipv4Header &header, Ptr<const NetDevice> idev,
-                  UnicastForwardCallback ucb, LocalDeliverCallback lcb);
+                  UnicastForwardCallback ucb, MulticastForwardCallback mcb,
+                  LocalDeliverCallback lcb, ErrorCallback ecb);
  virtual void NotifyInterfaceUp (uint32_t interface);
  virtual void NotifyInterfaceDown (uint32_t interface);
- virtual void NotifyInterfaceDown (uint32_t interface);
  virtual void NotifyAddAddress (uint32_t interface, Ipv4InterfaceAddress address);
  virtual void NotifyRemoveAddress (uint32_t interface, Ipv4InterfaceAddress address);
+ virtual void SetIpv4 (Ptr<Ipv4> ipv4);
+ virtual void PrintRoutingTable (Ptr<OutputStreamWrapper> stream, Time::Unit unit = Time::S) const;
+
+ /**
+  * TracedCallback signature for packets dropped from the handshake buffer.
+  *
+  * \param [in] packet The dropped packet.
+  * \param [in] header Its IPv4 header.
+  */
+ typedef void (* PendingDropTracedCallback)(Ptr<const Packet> packet, const Ipv4Header &header);
+
+ /**
+  * TracedCallback signature for packets handed to a relay.
+  *
+  * \param [in] packet The packet.
+  * \param [in] trafficClass Its carp::TrafficClass.
+  * \param [in] held Time it waited at this node for a relay.
+  */
+ typedef void (* ClassDelayTracedCallback)(Ptr<const Packet> packet, uint8_t trafficClass, Time held);
+
+ /**
+  * Assign a fixed random variable stream number to the random variables
+  * used by this model.  Return the number of streams (possibly zero) that
+  * have been assigned.
+  */
+ int64_t AssignStreams (int64_t stream);
+
+ // Handshake buffer parameters
+ uint32_t GetMaxQueueLen () const
+ {
+   return m_queue.GetMaxQueueLen ();
+ }
+ void SetMaxQueueLen (uint32_t len)
+ {
+   m_queue.SetMaxQueueLen (len);
+ }
+ Time GetMaxQueueTime () const
+ {
+   return m_queue.GetQueueTimeout ();
+ }
+ void SetMaxQueueTime (Time t)
+ {
+   m_queue.SetQueueTimeout (t);
+ }
+ /// Packets dropped from the handshake buffer because they waited longer than MaxQueueTime
+ uint32_t GetQueueTimeoutDrops () const
+ {
+   return m_queue.GetTimeoutDrops ();
+ }
+ /// Packets dropped from the handshake buffer because their destination had MaxQueueLen waiting
+ uint32_t GetQueueOverflowDrops () const
+ {
+   return m_queue.GetOverflowDrops ();
+ }
+ /// Packets dropped from the handshake buffer because no PONG came after MaxHandshakeRetries
+ uint32_t GetHandshakeDrops () const
+ {
+   return m_handshakeDrops;
+ }
+
+ /// Routing state of one node at one instant, as written by the periodic state dump
+ struct StateSnapshot
+ {
+   uint32_t m_neighbors; // Neighbors that have not expired
+   uint32_t m_hopCount; // Hop gradient to the sink, UINT32_MAX if unknown
+   Ipv4Address m_relay; // Current relay, Ipv4Address () if none is valid
+   uint32_t m_queue; // Packets waiting for a handshake
+   double m_energy; // Residual energy fraction
+   double m_linkQuality; // Link quality towards the current relay
+ };
+ StateSnapshot GetStateSnapshot ();
+ /// Time packets of a class waited at this node for a relay, one sample per packet sent on
+ const RunningStats &GetClassDelay (TrafficClass c) const
+ {
+   return m_classDelay[c];
+ }
+ /// \returns an estimate of the bytes this agent holds, its own object and heap state together,
+ /// buffered packets, timers and control sockets included
+ uint32_t GetMemoryUsage ();
 
  // Set broadcast enable flag
  void SetBroadcastEnable (bool f)
@@ -48,13 +317,130 @@ public:
  }
 
 
+protected:
+ virtual void DoInitialize (void);
+ virtual void DoDispose (void);
 
 private: 
+ /// A neighbor that answered the last PING, ranked for relay selection
+ struct RelayCandidate
+ {
+   Ipv4Address m_address; // Neighbor that sent the PONG
+   uint8_t m_hopCount; // Its hop count to the sink
+   double m_score; // Channel, queue and energy fitness in [0,1]
+ };
+
+ Neighbors m_nb; // One-hop neighbors and their link estimates
+
  /* Protocol Parameters */
  Time m_nextHopWait;  // Period of waiting for the neighbor's PONG reply 
+ Time m_handshakeBackoff; // Delay before the first retry of a handshake without PONG, doubled per retry
+ uint32_t m_maxHandshakeRetries; // Retries before the buffered packets are dropped
+ uint32_t m_handshakeRetries; // Consecutive handshakes closed without a PONG
+ uint32_t m_handshakeDrops; // Buffered packets dropped after MaxHandshakeRetries handshakes without a PONG
  bool m_enableBroadcast;  // Indicates whether a broadcast data packets forwarding 
  uint32_t m_requestId;  // Broadcast ID
  uint32_t m_seqNo; // Request Sequence number
+ double m_lqAlpha; // EWMA weight of the newest PHY sample
+ double m_snrMax; // SNR (dB) mapped to a link quality of 1
+ bool m_geoPrefilter; // PING only the neighbors making geographic progress towards the sink
+ Vector m_sinkPosition; // Position of the sink used by the geographic prefilter
+ double m_minProgress; // Least progress (m) for a neighbor to be PINGed in geographic mode
+ uint32_t m_broadcastThreshold; // Copies overheard that cancel a pending rebroadcast
+ Time m_broadcastJitter; // Upper bound of the random rebroadcast assessment delay
+ uint32_t m_hopCount; // Hops to the sink learned from HELLO
+ bool m_isSink; // Originates the HELLO rounds, hop count 0
+ Time m_helloInterval; // Period of the sink's HELLO rounds
+ uint16_t m_helloRound; // Latest sink HELLO round seen (originated at the sink)
+ Ipv4Address m_sinkAddress; // Sink of the latest HELLO round, never given a reverse path
+ Time m_relayLifetime; // How long the ranked relays of a handshake stay usable
+ Time m_urgentRelayLifetime; // How long urgent packets may still reuse them instead of waiting for a handshake
+ Time m_dataAckTimeout; // Time a relay has to acknowledge a data packet, zero disables the per-hop DATA_ACK
+ uint32_t m_maxDataAckRetries; // Resends of an unacknowledged packet before it is dropped
+ uint32_t m_expectedNeighbors; // Neighbor table entries reserved up front
+ bool m_compact; // Packed, bounded neighbor table and an RNG shared between bulk-installed copies
+ uint32_t m_compactLimit; // Neighbor table bound in compact mode
+ uint32_t m_piggybackMaxSize; // Largest IP packet carried on a DATA_PING, zero disables
+ Time m_claimWindow; // Contention window in which receivers of a DATA_PING claim its data
+ uint32_t m_reversePathLimit; // Most sensors a node keeps a downlink next hop for
+ Time m_reversePathLifetime; // How long a reverse path stays usable without fresh uplink traffic
+ Time m_aggregationDelay; // Longest a relay holds a packet to merge it with others, zero disables
+ uint32_t m_aggregationMaxSize; // Largest aggregate, IP header included
+ uint16_t m_aggregateId; // IP identification of the aggregates sent by this node
+
+ // Relay selection
+ std::vector<RelayCandidate> m_pongs; // PONGs collected during the open handshake
+ std::vector<RelayCandidate> m_relays; // Ranked relays of the last handshake, best first
+ Time m_relaysSelected; // Time m_relays was ranked
+ Timer m_pingTimer; // Closes the handshake after PingWaitTime
+ Timer m_backoffTimer; // Retries a handshake that got no PONG
+ Timer m_helloTimer; // Sink: opens the next HELLO round
+ Timer m_helloForwardTimer; // Jittered re-advertisement of an improved hop count
+
+ // Packets waiting for the open handshake
+ PacketQueue m_queue;
+ Ptr<NetDevice> m_lo; // Loopback device used to defer route requests until a relay is chosen
+ TracedCallback<Ptr<const Packet>, const Ipv4Header &> m_pendingDropTrace;
+ RunningStats m_classDelay[CLASS_COUNT];
+ TracedCallback<Ptr<const Packet>, uint8_t, Time> m_classDelayTrace;
+
+ /// A broadcast data packet seen during dissemination, keyed on origin and IP identification
+ struct Dissemination
+ {
+   Dissemination () : m_iif (-1), m_copies (0), m_inward (false) {}
+   Ptr<const Packet> m_packet;
+   Ipv4Header m_header;
+   UnicastForwardCallback m_ucb;
+   int32_t m_iif; // Interface the first copy arrived on
+   uint32_t m_copies; // Copies heard so far, the first one included; 0 if only the sender is known yet
+   bool m_inward; // A copy came from a neighbor closer to the sink, so carrying it on moves it outward
+   EventId m_rebroadcast; // Pending rebroadcast, cancelled once enough copies are heard
+   Time m_expire; // Duplicate detection lifetime
+ };
+ std::map<uint64_t, Dissemination> m_dissemination;
+
+ /// A data packet offered on a DATA_PING, keyed on origin and IP identification like m_dissemination
+ struct Claim
+ {
+   Ptr<Packet> m_packet; // IP packet, header included
+   QueueEntry m_entry; // Own offer: sent through the handshake if nobody claims it
+   Ptr<NetDevice> m_device; // Neighbor offer: device it arrived on
+   Ipv4Address m_sender; // Neighbor offer: node that sent the DATA_PING
+   EventId m_event; // Claim timer for a neighbor offer, fallback timer for an own offer
+   Time m_expire;
+ };
+ std::map<uint64_t, Claim> m_offers; // Own packets waiting for a claim
+ std::map<uint64_t, Claim> m_claims; // Neighbor packets this node contends for
+
+ /// Next hop back to a sensor, learned from the uplink packets it sent through this node
+ struct ReversePath
+ {
+   Ipv4Address m_nextHop; // Neighbor the sensor's packets arrived from
+   Time m_expire;
+ };
+ std::map<Ipv4Address, ReversePath> m_reversePaths; // At most m_reversePathLimit sensors
+
+ /// Routine packets to one destination waiting to be sent as a single aggregate
+ struct Aggregate
+ {
+   Ptr<Packet> m_payload; // IP packets concatenated, headers included
+   AggregateHeader m_header;
+   std::vector<QueueEntry> m_packets; // The packets as handed over, with their own callbacks
+   EventId m_flush; // Bounds the delay of the oldest packet
+ };
+ std::map<Ipv4Address, Aggregate> m_aggregates;
+
+ /// A data packet handed to a relay that has not acknowledged it yet, keyed like m_dissemination
+ struct HopAck
+ {
+   HopAck () : m_resends (0) {}
+   QueueEntry m_entry; // The packet as handed over, to resend it through the next relay
+   Ipv4Address m_relay; // Relay that owes the DATA_ACK
+   uint32_t m_resends; // Relays that already failed to acknowledge it
+   EventId m_timeout;
+   Time m_expire; // Kept past the timeout while a resend waits for a handshake
+ };
+ std::map<uint64_t, HopAck> m_hopAcks;
 
  // IP Protocol 
  Ptr<Ipv4> m_ipv4;
@@ -64,89 +450,105 @@ private:
  std::map<Ptr<Socket>, Ipv4InterfaceAddress>m_socketSubnetBroadcastAddress;
 
  /* Start Protocol Operation */
- void UpdateRouteToNeighbor (Ipv4Address sender, Ipv4Address receiver); // Update neighbor record (Not sure how important it is )
+ void BindTimers (); // Point timers and callbacks at this instance
  bool IsMyOwnAddress (Ipv4Address src); // Test whether the provided address is assigned to an interface
+ void OpenSocket (uint32_t interface, Ipv4InterfaceAddress iface); // CARP control socket on one interface
+ void CloseSocket (Ipv4InterfaceAddress iface);
+ Ptr<Socket> FindSocketWithInterfaceAddress (Ipv4InterfaceAddress iface) const;
+ bool GetPosition (Vector &position) const; // Position of this node, false without a MobilityModel
+ double GetResidualEnergy () const; // Residual fraction of the node's energy source
+ void StartHandshake (Ipv4Address dst, uint32_t numPkt); // Open a PING/PONG round for traffic towards dst
 
 
  // Send Methods
  void SendHello (HelloHeader const & helloheader); // Send Hello Packet (Broadcast type)
+ void HelloTimerExpire (); // Sink: start the next gradient round
+ void ForwardHello (); // Pass our hop count of the current round on
  void SendPing (PingHeader const & pingheader, Ipv4Address dst); // Send Ping Packet
  void SendPong (PongHeader const & pongheader, Ipv4Address src); // Send Pong packet to sender nodes (All neighbors of source node)
- void SendPacket (Ipv4Address dst, 
+ void SendTo (Ptr<Socket> socket, Ptr<Packet> packet, Ipv4Address dest); // Send a CARP control packet through socket
  Ptr<UniformRandomVariable> m_uniformRandomVariable; // Provides uniform random variable
 
  // Receive Control Packets
  void RecvPing (Ptr<Packet> p, PingHeader const &pingheader); // The source information and other packet header information are contained in the header
  void RecvPong (Ptr<Packet> p, PongHeader const &pongheader); // Pong response from neighbors 
- void DataReplyAck (Ipv4Address neighbor); // Ack response from neighbor after successful reception of packets 
+ void DataReplyAck (Ipv4Address neighbor, const Ipv4Header & header); // Acknowledge a data packet to the neighbor it came from
  void ProcessHello (Ptr<Packet> p, Ipv4Address receiver);
+ void RecvCarp (Ptr<Socket> socket); // Dispatch a received CARP control packet on its type
+
+ // Relay selection and failover
+ void SelectRelay (); // Rank the collected PONGs once PingWaitTime is over
+ void RetryHandshake (); // Backoff over: PING again for the packets still buffered
+ static bool RankRelays (const RelayCandidate &a, const RelayCandidate &b);
+ bool GetRelay (Ipv4Address &relay, TrafficClass c = CLASS_ROUTINE); // Best relay still inside the validity window of c
+ void RelayFailed (Ipv4Address relay); // Drop relay and promote the next ranked candidate
+ void SendToRelay (Ptr<Ipv4Route> route, Ptr<const Packet> p, const Ipv4Header & header,
+                   UnicastForwardCallback ucb, ErrorCallback ecb); // Stamp this hop and watch for the DATA_ACK
+ static void StampHop (Ptr<Packet> p, Ptr<Ipv4Route> route, bool ackRequested); // Name this node as previous hop
+ void WatchDataAck (Ptr<const Packet> p, const Ipv4Header & header, Ipv4Address relay,
+                    UnicastForwardCallback ucb, ErrorCallback ecb);
+ void DataAckExpire (uint64_t key); // Relay silent: resend through the next candidate
+ Ptr<Ipv4Route> NeighborRoute (Ipv4Address dst, Ipv4Address gateway); // Route towards dst through a neighbor
+
+ // Downlink towards individual sensors
+ void LearnReversePath (Ipv4Address origin, Ipv4Address prevHop);
+ bool GetReversePath (Ipv4Address dst, Ipv4Address &nextHop); // Next hop back to dst if still fresh
+
+ // Handshake buffer
+ Ptr<Ipv4Route> LoopbackRoute (const Ipv4Header & header, Ptr<NetDevice> oif) const;
+ void DeferredRouteOutput (Ptr<const Packet> p, const Ipv4Header & header,
+                           UnicastForwardCallback ucb, ErrorCallback ecb); // Queue packet and open a handshake
+ void SendPacketFromQueue (); // Release every buffered packet to the chosen relay
+ void PendingDrop (Ptr<const Packet> p, const Ipv4Header & header);
+ void ClassSent (Ptr<const Packet> p, TrafficClass c, Time held); // Per-class hold time statistics
+ static bool IsControl (Ptr<const Packet> p, const Ipv4Header & header); // CARP control: tagged, or on CARP_PORT
+
+ // Zero-handshake mode: small packets ride on the PING and the best receiver claims them
+ bool OfferOnPing (Ptr<const Packet> p, const Ipv4Header & header,
+                   UnicastForwardCallback ucb, ErrorCallback ecb); // Send a DATA_PING instead of queueing
+ void OfferTimeout (uint64_t key); // Nobody claimed our packet, fall back to the handshake
+ void RecvDataPing (Ptr<Packet> p, PingHeader const &pingheader, Ipv4Address sender, Ipv4Address receiver);
+ void ClaimData (uint64_t key); // Our claim timer won: acknowledge and forward the packet
+ void RecvDataAck (DataAckHeader const &ackheader, Ipv4Address sender); // A claim, or a relay acknowledging our packet
+
+ // Sink-to-all dissemination
+ bool IsBroadcast (Ipv4Address dst) const; // Limited or subnet-directed broadcast on a CARP interface
+ Ptr<Ipv4Route> BroadcastRoute (Ipv4Address dst, Ptr<NetDevice> oif) const;
+ void RecvBroadcastData (Ptr<const Packet> p, const Ipv4Header & header, UnicastForwardCallback ucb,
+                         LocalDeliverCallback lcb, int32_t iif);
+ void Rebroadcast (uint64_t key);
+ void NoteBroadcastSender (const Ipv4Header & header, const Address &from); // Mark copies from inward neighbors
+ static uint64_t PacketKey (const Ipv4Header & header); // Origin and IP identification of a data packet
+ bool Forwarding (Ptr<const Packet> p, const Ipv4Header & header, Ipv4Address prevHop,
+                  UnicastForwardCallback ucb, ErrorCallback ecb);
+ void SendUplink (Ptr<const Packet> p, const Ipv4Header & header,
+                  UnicastForwardCallback ucb, ErrorCallback ecb); // Current relay, else the handshake buffer
+
+ // In-network aggregation
+ bool AddToAggregate (Ptr<const Packet> p, const Ipv4Header & header,
+                      UnicastForwardCallback ucb, ErrorCallback ecb); // False if p must be sent on its own
+ void FlushAggregate (Ipv4Address dst);
+ static Tag *CreateTag (TypeId tid); // Default instance of a tag type to copy a tag through, 0 if none
+ void Deaggregate (Ptr<const Packet> p, Ptr<const NetDevice> idev); // Re-inject the packets of an aggregate for us
+
+ // Cross-layer hooks feeding the neighbor link estimates
+ void ConnectPhyTraces (Ptr<NetDevice> dev); // Subscribe to the PHY/MAC traces of a Wifi or UAN device
+ void WifiSnifferRx (Ptr<const Packet> packet, uint16_t channelFreqMhz, WifiTxVector txVector,
+                     MpduInfo aMpdu, SignalNoiseDbm signalNoise);
+ void UanPhyRxOk (Ptr<const Packet> packet, double sinr, UanTxMode mode);
+ void MacTxFailed (Mac48Address address); // Final data failure reported by the Wifi station manager or the link channel
+ void LinkRxOk (Ptr<const Packet> packet, Mac48Address from, double quality); // Frame from the abstract link channel
+ bool IsInwardNeighbor (Ipv4Address neighbor); // Neighbor closer to the sink than this node
+ // Learn neighbor MAC addresses from received CARP frames instead of ARP, and reverse paths from data frames
+ void ReceiveFromDevice (Ptr<NetDevice> device, Ptr<const Packet> packet, uint16_t protocol,
+                         const Address &from, const Address &to, NetDevice::PacketType packetType);
 
 
 
 };
 
-class Neighbors
-
-{
-
-public:
-
-  /**
-
-   * constructor
-
-   * \param delay the delay time for purging the list of neighbors
-
-   */
-
-  Neighbors (Time delay);
-
-  /// Neighbor description
-  struct Neighbor
-  {
-    /// Neighbor IPv4 address
-    Ipv4Address m_neighborAddress;
-    /// Neighbor MAC address
-    Mac48Address m_hardwareAddress;
-    /// Neighbor expire time
-    Time m_expireTime;
-    bool close; // Not sure if this is needed for this scenario
-
-    /**
-     * \brief Neighbor structure constructor
-     *
-     * \param ip Ipv4Address entry
-     * \param mac Mac48Address entry
-     * \param t Time expire time
-     */
-
-    Neighbor (Ipv4Address ip, Mac48Address mac, Time t)
-      : m_neighborAddress (ip),
-        m_hardwareAddress (mac),
-        m_expireTime (t),
-        close (false)
-    {
-    }
-  };
-
-  Time GetExpireTime (Ipv4Address addr);
-  /**
-   * \returns true if the node with IP address is a neighbor
-   */
-  bool IsNeighbor (Ipv4Address addr);
-  /**
-   * Update expire time for entry with address addr, if it exists, else add new entry
-   */
-  void Update (Ipv4Address addr, Time expire);
-
-private:
-  Timer m_ntimer;
-  std::vector<Neighbor>m_nb;
-  Mac48Address LookupMacAddress (Ipv44Address addr);
-
-
-}; // End of class Neighbors
 
 } // End of carp namespace
 } // End of ns3 namespace 
 
+#endif /* CARP_ROUTING_PROTOCOL_H */
@@ -0,0 +1,43 @@
+/* Streaming mean and variance for CARP statistics */
+
+#include "carp-running-stats.h"
+#include <cmath>
+#include <limits>
+
+namespace ns3 {
+namespace carp {
+
+RunningStats::RunningStats ()
+  : m_count (0),
+    m_mean (0.0),
+    m_m2 (0.0)
+{
+}
+
+void
+RunningStats::Add (double x)
+{
+  m_count++;
+  double delta = x - m_mean;
+  m_mean += delta / m_count;
+  m_m2 += delta * (x - m_mean);
+}
+
+double
+RunningStats::GetVariance () const
+{
+  return m_count > 1 ? m_m2 / (m_count - 1) : 0.0;
+}
+
+double
+RunningStats::GetHalfWidth (double z) const
+{
+  if (m_count < 2)
+    {
+      return std::numeric_limits<double>::infinity ();
+    }
+  return z * std::sqrt (GetVariance () / m_count);
+}
+
+} // namespace carp
+} // namespace ns3
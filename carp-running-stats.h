@@ -0,0 +1,33 @@
+/* Streaming mean and variance for CARP statistics */
+
+#ifndef CARP_RUNNING_STATS_H
+#define CARP_RUNNING_STATS_H
+
+#include <stdint.h>
+
+namespace ns3 {
+namespace carp {
+
+/// Streaming mean and variance (Welford), constant memory
+class RunningStats
+{
+public:
+  RunningStats ();
+  void Add (double x);
+  uint64_t GetCount () const { return m_count; }
+  double GetMean () const { return m_mean; }
+  /// Unbiased sample variance, 0 below two samples
+  double GetVariance () const;
+  /// Half width of the confidence interval of the mean for the normal quantile z
+  double GetHalfWidth (double z) const;
+
+private:
+  uint64_t m_count;
+  double m_mean;
+  double m_m2; // Sum of squared deviations from the running mean
+};
+
+} // namespace carp
+} // namespace ns3
+
+#endif /* CARP_RUNNING_STATS_H */
@@ -0,0 +1,146 @@
+/* Streaming columnar dump of the CARP routing state of many nodes */
+
+#include "carp-state-writer.h"
+#include "ns3/log.h"
+#include "ns3/abort.h"
+#include "ns3/simulator.h"
+#include "ns3/system-path.h"
+#include <cstring>
+#include <cstdio>
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("CarpStateWriter");
+
+namespace carp {
+
+namespace {
+// Order of the columns written by Snapshot ()
+const char * const COLUMN_NAMES[] = { "time_s", "node", "neighbors", "hop_count", "relay",
+                                      "queue", "energy", "link_quality" };
+const char * const COLUMN_DESCR[] = { "<f8", "<u4", "<u4", "<u4", "<u4", "<u4", "<f8", "<f8" };
+const uint32_t N_COLUMNS = 8;
+// Header size of version 1.0 .npy files written here, a multiple of 64 as NumPy expects
+const uint32_t NPY_HEADER_LEN = 128;
+}
+
+StateWriter::Column::Column (std::string path, std::string descr)
+  : m_out (path.c_str (), std::ios::out | std::ios::binary | std::ios::trunc),
+    m_descr (descr),
+    m_rows (0)
+{
+  NS_ABORT_MSG_UNLESS (m_out.is_open (), "Cannot open CARP state column " << path);
+  WriteHeader ();
+}
+
+// The shape field has a fixed width so the header can be rewritten in place once the row count is known
+void
+StateWriter::Column::WriteHeader ()
+{
+  char dict[NPY_HEADER_LEN];
+  int n = std::snprintf (dict, sizeof (dict), "{'descr': '%s', 'fortran_order': False, 'shape': (%20llu,), }",
+                         m_descr.c_str (), (unsigned long long) m_rows);
+  std::string header ("\x93NUMPY\x01\x00", 8);
+  uint16_t dictLen = NPY_HEADER_LEN - 10;
+  header.push_back ((char) (dictLen & 0xff));
+  header.push_back ((char) (dictLen >> 8));
+  header.append (dict, n);
+  header.append (NPY_HEADER_LEN - 1 - header.size (), ' ');
+  header.push_back ('\n');
+  m_out.seekp (0);
+  m_out.write (header.data (), header.size ());
+}
+
+void
+StateWriter::Column::WriteU32 (uint32_t v)
+{
+  char b[4] = { (char) v, (char) (v >> 8), (char) (v >> 16), (char) (v >> 24) };
+  m_out.write (b, 4);
+  m_rows++;
+}
+
+void
+StateWriter::Column::WriteF64 (double v)
+{
+  uint64_t bits;
+  std::memcpy (&bits, &v, sizeof (bits));
+  char b[8];
+  for (uint32_t i = 0; i < 8; ++i)
+    {
+      b[i] = (char) (bits >> (8 * i));
+    }
+  m_out.write (b, 8);
+  m_rows++;
+}
+
+void
+StateWriter::Column::Close ()
+{
+  WriteHeader ();
+  m_out.close ();
+}
+
+StateWriter::StateWriter (std::string directory)
+  : m_closed (false)
+{
+  SystemPath::MakeDirectories (directory);
+  for (uint32_t i = 0; i < N_COLUMNS; ++i)
+    {
+      m_columns.push_back (new Column (directory + "/" + COLUMN_NAMES[i] + ".npy", COLUMN_DESCR[i]));
+    }
+}
+
+StateWriter::~StateWriter ()
+{
+  Close ();
+  for (std::vector<Column *>::iterator i = m_columns.begin (); i != m_columns.end (); ++i)
+    {
+      delete *i;
+    }
+}
+
+void
+StateWriter::Track (uint32_t nodeId, Ptr<RoutingProtocol> agent)
+{
+  m_nodeIds.push_back (nodeId);
+  m_agents.push_back (agent);
+}
+
+void
+StateWriter::Snapshot ()
+{
+  if (m_closed)
+    {
+      return;
+    }
+  double now = Simulator::Now ().GetSeconds ();
+  for (uint32_t n = 0; n < m_agents.size (); ++n)
+    {
+      RoutingProtocol::StateSnapshot state = m_agents[n]->GetStateSnapshot ();
+      m_columns[0]->WriteF64 (now);
+      m_columns[1]->WriteU32 (m_nodeIds[n]);
+      m_columns[2]->WriteU32 (state.m_neighbors);
+      m_columns[3]->WriteU32 (state.m_hopCount);
+      m_columns[4]->WriteU32 (state.m_relay.Get ());
+      m_columns[5]->WriteU32 (state.m_queue);
+      m_columns[6]->WriteF64 (state.m_energy);
+      m_columns[7]->WriteF64 (state.m_linkQuality);
+    }
+}
+
+void
+StateWriter::Close ()
+{
+  if (m_closed)
+    {
+      return;
+    }
+  m_closed = true;
+  for (std::vector<Column *>::iterator i = m_columns.begin (); i != m_columns.end (); ++i)
+    {
+      (*i)->Close ();
+    }
+}
+
+} // namespace carp
+} // namespace ns3
@@ -0,0 +1,63 @@
+/* Streaming columnar dump of the CARP routing state of many nodes */
+
+#ifndef CARP_STATE_WRITER_H
+#define CARP_STATE_WRITER_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include "ns3/simple-ref-count.h"
+#include "ns3/nstime.h"
+#include "ns3/carp-routing-protocol.h"
+
+namespace ns3 {
+namespace carp {
+
+/*
+ * Appends one row per tracked node and snapshot to a set of NumPy .npy column
+ * files in a directory (time_s, node, neighbors, hop_count, relay, queue,
+ * energy, link_quality). Rows are streamed to disk as they are produced; the
+ * row count in each file header is patched when the writer is closed. Load with
+ *
+ *   pandas.DataFrame ({c: numpy.load (d + "/" + c + ".npy") for c in columns})
+ */
+class StateWriter : public SimpleRefCount<StateWriter>
+{
+public:
+  /// Create the column files under directory, which is created if missing
+  StateWriter (std::string directory);
+  ~StateWriter ();
+
+  /// Include the routing protocol of node nodeId in every snapshot
+  void Track (uint32_t nodeId, Ptr<RoutingProtocol> agent);
+  /// Append the current state of every tracked node
+  void Snapshot ();
+  /// Write the final row counts; further snapshots are ignored
+  void Close ();
+
+private:
+  /// One .npy file holding a single little-endian column
+  class Column
+  {
+  public:
+    Column (std::string path, std::string descr);
+    void WriteU32 (uint32_t v);
+    void WriteF64 (double v);
+    void Close ();
+  private:
+    void WriteHeader ();
+    std::ofstream m_out;
+    std::string m_descr; // NumPy dtype of the column
+    uint64_t m_rows;
+  };
+
+  std::vector<uint32_t> m_nodeIds;
+  std::vector<Ptr<RoutingProtocol> > m_agents;
+  std::vector<Column *> m_columns;
+  bool m_closed;
+};
+
+} // namespace carp
+} // namespace ns3
+
+#endif /* CARP_STATE_WRITER_H */
@@ -0,0 +1,417 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+
+/* Benchmark that runs the same sensor field and traffic over CARP, AODV, OLSR and DSDV
+ * and prints one CSV row per protocol:
+ *
+ *   protocol,nodes,tx_pkts,rx_pkts,pdr,pdr_hw,mean_delay_s,delay_hw_s,p99_delay_s,
+ *   ctrl_bytes_per_data_byte,energy_j_per_bit,wallclock_s,sim_time_s,converged
+ *
+ * Usage: ./waf --run "carp-routing-benchmark --gridWidth=10 --simTime=100 --protocols=carp,aodv"
+ *
+ * Control bytes are every routing protocol and ARP transmission, per hop; readings carried
+ * inside CARP control packets count as data.
+ *
+ * --channel=link swaps the 802.11b PHY for the abstract carp::LinkChannel (disk of
+ * --range metres), which skips the per-frame PHY work on large grids; energy is then not modelled.
+ * --linkTrace=<file> replays recorded link measurements on it (see carp::LinkTraceReader).
+ *
+ * PDR and delay are batch means over the readings sent after the first interval (see
+ * carp::EarlyStop), the _hw columns the half widths of their --confidence intervals.
+ * --pdrHalfWidth and --delayHalfWidth turn simTime into an upper bound: each run stops
+ * as soon as the intervals of PDR (absolute) and mean delay (relative) are that narrow,
+ * and converged is 1 if it did.
+ */
+
+#include "ns3/core-module.h"
+#include "ns3/network-module.h"
+#include "ns3/internet-module.h"
+#include "ns3/mobility-module.h"
+#include "ns3/wifi-module.h"
+#include "ns3/applications-module.h"
+#include "ns3/energy-module.h"
+#include "ns3/flow-monitor-module.h"
+#include "ns3/aodv-helper.h"
+#include "ns3/olsr-helper.h"
+#include "ns3/dsdv-helper.h"
+#include "ns3/carp-helper.h"
+#include "ns3/carp-header.h"
+#include "ns3/carp-link-channel.h"
+#include "ns3/carp-link-net-device.h"
+#include "ns3/carp-early-stop.h"
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <map>
+
+using namespace ns3;
+
+NS_LOG_COMPONENT_DEFINE ("CarpRoutingBenchmark");
+
+namespace {
+
+const uint16_t APP_PORT = 9;
+
+/// Scenario shared by every protocol run
+struct Scenario
+{
+  uint32_t gridWidth;   // Nodes per grid row, node 0 is the sink
+  uint32_t nodes;
+  double spacing;       // Distance between grid neighbors (m)
+  double simTime;       // Simulated seconds
+  double warmup;        // Time before sensors start reporting
+  double interval;      // Seconds between two readings of one sensor
+  uint32_t packetSize;  // Reading size (bytes)
+  double initialEnergy; // Battery per node (J)
+  std::string channel;  // "wifi" or "link"
+  double range;         // Link channel range (m)
+  std::string linkTrace; // Recorded link measurements replayed on the link channel
+  double pdrHalfWidth;  // Early stop target for PDR, 0 to ignore
+  double delayHalfWidth; // Early stop target for mean delay relative to the mean, 0 to ignore
+  double batch;         // Early stop batch length (s)
+  double confidence;    // Early stop confidence level
+  double aggregationDelay; // CARP relay aggregation delay (s), 0 disables
+};
+
+/// Metrics of one protocol run
+struct Result
+{
+  std::string protocol;
+  uint64_t txPackets;
+  uint64_t rxPackets;
+  double pdr;
+  double pdrHalfWidth;
+  double meanDelay;
+  double delayHalfWidth;
+  double p99Delay;
+  double ctrlPerData;
+  double energyPerBit;
+  double wallClock;
+  double simTime;
+  bool converged;
+};
+
+uint64_t g_ctrlBytes = 0;
+Ptr<carp::EarlyStop> g_earlyStop;
+
+bool
+IsAppPacket (const Ipv4Header &header, Ptr<const Packet> packet)
+{
+  UdpHeader udpHeader;
+  return header.GetProtocol () == UdpL4Protocol::PROT_NUMBER
+         && packet->PeekHeader (udpHeader) && udpHeader.GetDestinationPort () == APP_PORT;
+}
+
+// Readings leaving their sensor, forwarded hops excluded
+void
+AppTx (const Ipv4Header &header, Ptr<const Packet> packet, uint32_t interface)
+{
+  if (g_earlyStop && IsAppPacket (header, packet))
+    {
+      g_earlyStop->NotifySent ();
+    }
+}
+
+void
+AppRx (const Ipv4Header &header, Ptr<const Packet> packet, uint32_t interface)
+{
+  if (!g_earlyStop || !IsAppPacket (header, packet))
+    {
+      return;
+    }
+  Ptr<Packet> copy = packet->Copy ();
+  UdpHeader udpHeader;
+  copy->RemoveHeader (udpHeader);
+  SeqTsHeader seqTs;
+  copy->PeekHeader (seqTs);
+  g_earlyStop->NotifyReceived (Simulator::Now () - seqTs.GetTs ());
+}
+
+// Routing bytes of every IP transmission, forwarded hops included; readings, also those riding on a
+// CARP DATA_PING or merged into a CARP aggregate, are data
+void
+Ipv4Tx (Ptr<const Packet> packet, Ptr<Ipv4> ipv4, uint32_t interface)
+{
+  Ptr<Packet> copy = packet->Copy ();
+  Ipv4Header ipHeader;
+  copy->RemoveHeader (ipHeader);
+  if (ipHeader.GetProtocol () == UdpL4Protocol::PROT_NUMBER)
+    {
+      UdpHeader udpHeader;
+      copy->RemoveHeader (udpHeader);
+      if (udpHeader.GetDestinationPort () == APP_PORT)
+        {
+          return;
+        }
+      carp::TypeHeader tHeader;
+      if (udpHeader.GetDestinationPort () == carp::RoutingProtocol::CARP_PORT
+          && copy->RemoveHeader (tHeader) && tHeader.IsValid () && tHeader.Get () == carp::CARPTYPE_DATA_PING)
+        {
+          carp::PingHeader pingHeader;
+          copy->RemoveHeader (pingHeader);
+          g_ctrlBytes += packet->GetSize () - copy->GetSize (); // The rest is the reading it carries
+          return;
+        }
+    }
+  if (ipHeader.GetProtocol () == carp::RoutingProtocol::AGGREGATE_PROTOCOL)
+    {
+      carp::AggregateHeader aggHeader;
+      copy->RemoveHeader (aggHeader);
+      g_ctrlBytes += packet->GetSize () - copy->GetSize (); // The rest are the readings, IP headers included
+      return;
+    }
+  g_ctrlBytes += packet->GetSize ();
+}
+
+// Address resolution is routing overhead too; on Wifi the frame still has its LLC header here
+void
+WifiMacTx (Ptr<const Packet> packet)
+{
+  LlcSnapHeader llc;
+  if (packet->PeekHeader (llc) && llc.GetType () == ArpL3Protocol::PROT_NUMBER)
+    {
+      g_ctrlBytes += packet->GetSize () - llc.GetSerializedSize ();
+    }
+}
+
+void
+LinkTx (Ptr<const Packet> packet, uint16_t protocol)
+{
+  if (protocol == ArpL3Protocol::PROT_NUMBER)
+    {
+      g_ctrlBytes += packet->GetSize ();
+    }
+}
+
+void
+InstallRouting (std::string protocol, InternetStackHelper &stack)
+{
+  if (protocol == "carp")
+    {
+      CarpHelper carp;
+      stack.SetRoutingHelper (carp);
+    }
+  else if (protocol == "aodv")
+    {
+      AodvHelper aodv;
+      stack.SetRoutingHelper (aodv);
+    }
+  else if (protocol == "olsr")
+    {
+      OlsrHelper olsr;
+      stack.SetRoutingHelper (olsr);
+    }
+  else if (protocol == "dsdv")
+    {
+      DsdvHelper dsdv;
+      stack.SetRoutingHelper (dsdv);
+    }
+  else
+    {
+      NS_FATAL_ERROR ("Unknown protocol " << protocol);
+    }
+}
+
+Result
+RunScenario (std::string protocol, const Scenario &sc)
+{
+  g_ctrlBytes = 0;
+  NodeContainer nodes;
+  nodes.Create (sc.nodes);
+
+  MobilityHelper mobility;
+  mobility.SetPositionAllocator ("ns3::GridPositionAllocator",
+                                 "MinX", DoubleValue (0.0),
+                                 "MinY", DoubleValue (0.0),
+                                 "DeltaX", DoubleValue (sc.spacing),
+                                 "DeltaY", DoubleValue (sc.spacing),
+                                 "GridWidth", UintegerValue (sc.gridWidth),
+                                 "LayoutType", StringValue ("RowFirst"));
+  mobility.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
+  mobility.Install (nodes);
+
+  NetDeviceContainer devices;
+  BasicEnergySourceHelper sourceHelper;
+  sourceHelper.Set ("BasicEnergySourceInitialEnergyJ", DoubleValue (sc.initialEnergy));
+  EnergySourceContainer sources = sourceHelper.Install (nodes);
+  if (sc.channel == "link")
+    {
+      Ptr<carp::LinkChannel> channel = CreateObject<carp::LinkChannel> ();
+      channel->SetAttribute ("Range", DoubleValue (sc.range));
+      devices = channel->Install (nodes);
+      if (!sc.linkTrace.empty ())
+        {
+          channel->ReplayTrace (sc.linkTrace);
+        }
+    }
+  else
+    {
+      WifiHelper wifi;
+      wifi.SetStandard (WIFI_PHY_STANDARD_80211b);
+      wifi.SetRemoteStationManager ("ns3::ConstantRateWifiManager",
+                                    "DataMode", StringValue ("DsssRate1Mbps"),
+                                    "ControlMode", StringValue ("DsssRate1Mbps"));
+      YansWifiChannelHelper channel = YansWifiChannelHelper::Default ();
+      YansWifiPhyHelper phy = YansWifiPhyHelper::Default ();
+      phy.SetChannel (channel.Create ());
+      WifiMacHelper mac;
+      mac.SetType ("ns3::AdhocWifiMac");
+      devices = wifi.Install (phy, mac, nodes);
+      WifiRadioEnergyModelHelper radioEnergy;
+      radioEnergy.Install (devices, sources);
+    }
+
+  InternetStackHelper stack;
+  InstallRouting (protocol, stack);
+  stack.Install (nodes);
+  Ipv4AddressHelper address;
+  address.SetBase ("10.0.0.0", "255.255.0.0");
+  Ipv4InterfaceContainer interfaces = address.Assign (devices);
+  if (protocol == "carp")
+    {
+      nodes.Get (0)->GetObject<carp::RoutingProtocol> ()->SetAttribute ("IsSink", BooleanValue (true));
+      Config::Set ("/NodeList/*/$ns3::carp::RoutingProtocol/SinkPosition", VectorValue (Vector (0, 0, 0)));
+      Config::Set ("/NodeList/*/$ns3::carp::RoutingProtocol/AggregationDelay", TimeValue (Seconds (sc.aggregationDelay)));
+    }
+  Config::ConnectWithoutContext ("/NodeList/*/$ns3::Ipv4L3Protocol/Tx", MakeCallback (&Ipv4Tx));
+  Config::ConnectWithoutContext ("/NodeList/*/DeviceList/*/$ns3::WifiNetDevice/Mac/MacTx", MakeCallback (&WifiMacTx));
+  Config::ConnectWithoutContext ("/NodeList/*/DeviceList/*/$ns3::carp::LinkNetDevice/Tx", MakeCallback (&LinkTx));
+  // Without half widths the batch statistics are only reported, the run lasts simTime
+  g_earlyStop = Create<carp::EarlyStop> (Seconds (sc.batch), sc.confidence);
+  g_earlyStop->SetPdrHalfWidth (sc.pdrHalfWidth);
+  g_earlyStop->SetDelayHalfWidth (sc.delayHalfWidth);
+  // Every sensor is reporting by the end of the first interval
+  g_earlyStop->Start (Seconds (sc.warmup + sc.interval));
+  Config::ConnectWithoutContext ("/NodeList/*/$ns3::Ipv4L3Protocol/SendOutgoing", MakeCallback (&AppTx));
+  Config::ConnectWithoutContext ("/NodeList/*/$ns3::Ipv4L3Protocol/LocalDeliver", MakeCallback (&AppRx));
+
+  // Every sensor reports to the sink at node 0
+  UdpServerHelper server (APP_PORT);
+  ApplicationContainer serverApp = server.Install (nodes.Get (0));
+  serverApp.Start (Seconds (0));
+  UdpClientHelper client (interfaces.GetAddress (0), APP_PORT);
+  client.SetAttribute ("MaxPackets", UintegerValue (0));
+  client.SetAttribute ("Interval", TimeValue (Seconds (sc.interval)));
+  client.SetAttribute ("PacketSize", UintegerValue (sc.packetSize));
+  for (uint32_t i = 1; i < sc.nodes; ++i)
+    {
+      ApplicationContainer app = client.Install (nodes.Get (i));
+      // Desynchronise the sensors deterministically so every protocol sees the same offered load
+      app.Start (Seconds (sc.warmup + sc.interval * i / sc.nodes));
+      app.Stop (Seconds (sc.simTime));
+    }
+
+  FlowMonitorHelper flowHelper;
+  Ptr<FlowMonitor> monitor = flowHelper.InstallAll ();
+
+  Simulator::Stop (Seconds (sc.simTime + 1));
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+  Simulator::Run ();
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now ();
+
+  monitor->CheckForLostPackets ();
+  std::map<FlowId, FlowMonitor::FlowStats> stats = monitor->GetFlowStats ();
+  Ptr<Ipv4FlowClassifier> classifier = DynamicCast<Ipv4FlowClassifier> (flowHelper.GetClassifier ());
+  Result r;
+  r.protocol = protocol;
+  r.txPackets = 0;
+  r.rxPackets = 0;
+  uint64_t rxBytes = 0;
+  for (std::map<FlowId, FlowMonitor::FlowStats>::const_iterator i = stats.begin (); i != stats.end (); ++i)
+    {
+      if (classifier->FindFlow (i->first).destinationPort != APP_PORT)
+        {
+          continue; // Routing control flows are counted as overhead only
+        }
+      r.txPackets += i->second.txPackets;
+      r.rxPackets += i->second.rxPackets;
+      rxBytes += i->second.rxBytes;
+    }
+  r.pdr = g_earlyStop->GetPdr ().GetMean ();
+  r.pdrHalfWidth = g_earlyStop->GetPdr ().GetHalfWidth (g_earlyStop->GetZ ());
+  r.meanDelay = g_earlyStop->GetDelay ().GetMean ();
+  r.delayHalfWidth = g_earlyStop->GetDelay ().GetHalfWidth (g_earlyStop->GetZ ());
+  r.p99Delay = g_earlyStop->GetDelayP99 ();
+  r.converged = g_earlyStop->IsConverged ();
+  r.ctrlPerData = rxBytes ? (double) g_ctrlBytes / rxBytes : 0.0;
+  double consumed = 0.0;
+  for (EnergySourceContainer::Iterator i = sources.Begin (); i != sources.End (); ++i)
+    {
+      consumed += sc.initialEnergy - (*i)->GetRemainingEnergy ();
+    }
+  r.energyPerBit = rxBytes ? consumed / (rxBytes * 8.0) : 0.0;
+  r.wallClock = std::chrono::duration<double> (end - start).count ();
+  r.simTime = Simulator::Now ().GetSeconds ();
+  g_earlyStop = 0;
+
+  Simulator::Destroy ();
+  return r;
+}
+
+} // namespace
+
+int
+main (int argc, char *argv[])
+{
+  Scenario sc;
+  sc.gridWidth = 5;
+  sc.spacing = 80.0;
+  sc.simTime = 60.0;
+  sc.warmup = 10.0;
+  sc.interval = 1.0;
+  sc.packetSize = 64;
+  sc.initialEnergy = 100.0;
+  sc.channel = "wifi";
+  sc.range = 100.0;
+  sc.pdrHalfWidth = 0.0;
+  sc.delayHalfWidth = 0.0;
+  sc.batch = 5.0;
+  sc.confidence = 0.95;
+  sc.aggregationDelay = 0.0;
+  uint32_t gridHeight = 5;
+  uint32_t seed = 1;
+  uint32_t run = 1;
+  std::string protocols = "carp,aodv,olsr,dsdv";
+
+  CommandLine cmd;
+  cmd.AddValue ("gridWidth", "Nodes per grid row", sc.gridWidth);
+  cmd.AddValue ("gridHeight", "Number of grid rows", gridHeight);
+  cmd.AddValue ("spacing", "Distance between grid neighbors (m)", sc.spacing);
+  cmd.AddValue ("simTime", "Simulated time (s)", sc.simTime);
+  cmd.AddValue ("warmup", "Time before sensors start reporting (s)", sc.warmup);
+  cmd.AddValue ("interval", "Seconds between two readings of one sensor", sc.interval);
+  cmd.AddValue ("packetSize", "Reading size (bytes)", sc.packetSize);
+  cmd.AddValue ("initialEnergy", "Battery of every node (J)", sc.initialEnergy);
+  cmd.AddValue ("channel", "Channel model, wifi or link", sc.channel);
+  cmd.AddValue ("range", "Range of the link channel (m)", sc.range);
+  cmd.AddValue ("linkTrace", "Link measurement trace replayed on the link channel, node IDs as in the grid "
+                "(use with --range=0 to keep only the recorded links)", sc.linkTrace);
+  cmd.AddValue ("pdrHalfWidth", "Stop once the PDR confidence interval is this narrow, 0 to ignore", sc.pdrHalfWidth);
+  cmd.AddValue ("delayHalfWidth", "Stop once the mean delay confidence interval is this narrow, "
+                "relative to the mean, 0 to ignore", sc.delayHalfWidth);
+  cmd.AddValue ("batch", "Batch length for the early stop confidence intervals (s)", sc.batch);
+  cmd.AddValue ("confidence", "Confidence level of the early stop intervals", sc.confidence);
+  cmd.AddValue ("aggregationDelay", "Longest a CARP relay holds a reading to merge it with others (s), 0 disables",
+                sc.aggregationDelay);
+  cmd.AddValue ("seed", "RNG seed shared by all protocol runs", seed);
+  cmd.AddValue ("run", "RNG run number shared by all protocol runs", run);
+  cmd.AddValue ("protocols", "Comma separated list out of carp,aodv,olsr,dsdv", protocols);
+  cmd.Parse (argc, argv);
+  sc.nodes = sc.gridWidth * gridHeight;
+
+  std::cout << "protocol,nodes,tx_pkts,rx_pkts,pdr,pdr_hw,mean_delay_s,delay_hw_s,p99_delay_s,"
+            << "ctrl_bytes_per_data_byte,energy_j_per_bit,wallclock_s,sim_time_s,converged" << std::endl;
+  std::istringstream list (protocols);
+  std::string protocol;
+  while (std::getline (list, protocol, ','))
+    {
+      // Same seed and run for every protocol so topology and traffic are identical
+      RngSeedManager::SetSeed (seed);
+      RngSeedManager::SetRun (run);
+      Result r = RunScenario (protocol, sc);
+      std::cout << r.protocol << "," << sc.nodes << "," << r.txPackets << "," << r.rxPackets << ","
+                << r.pdr << "," << r.pdrHalfWidth << "," << r.meanDelay << "," << r.delayHalfWidth << ","
+                << r.p99Delay << "," << r.ctrlPerData << "," << r.energyPerBit << ","
+                << r.wallClock << "," << r.simTime << "," << r.converged << std::endl;
+    }
+  return 0;
+}
@@ -0,0 +1,385 @@
+/* Unit tests of the Channel-aware Routing Protocol building blocks */
+
+#include "ns3/test.h"
+#include "ns3/packet.h"
+#include "ns3/simulator.h"
+#include "ns3/carp-header.h"
+#include "ns3/carp-packet-queue.h"
+#include "ns3/carp-running-stats.h"
+#include "ns3/carp-early-stop.h"
+#include <cmath>
+
+using namespace ns3;
+using namespace ns3::carp;
+
+//-----------------------------------------------------------------------------
+// Handshake buffer
+//-----------------------------------------------------------------------------
+class CarpPacketQueueTest : public TestCase
+{
+public:
+  CarpPacketQueueTest () : TestCase ("Handshake buffer order, overflow and purge"), m_drops (0) {}
+  virtual void DoRun ();
+
+private:
+  QueueEntry MakeEntry (Ipv4Address dst, uint32_t size, TrafficClass c);
+  void Dropped (Ptr<const Packet> p, const Ipv4Header & header);
+  void CheckOrder ();
+  void CheckOverflow ();
+  void CheckPurge ();
+
+  uint32_t m_drops;
+};
+
+QueueEntry
+CarpPacketQueueTest::MakeEntry (Ipv4Address dst, uint32_t size, TrafficClass c)
+{
+  Ipv4Header header;
+  header.SetDestination (dst);
+  QueueEntry entry (Create<Packet> (size), header);
+  entry.SetTrafficClass (c);
+  return entry;
+}
+
+void
+CarpPacketQueueTest::Dropped (Ptr<const Packet> p, const Ipv4Header & header)
+{
+  m_drops++;
+}
+
+// Urgent packets leave first, FIFO within a class
+void
+CarpPacketQueueTest::CheckOrder ()
+{
+  PacketQueue q (8, Seconds (30));
+  Ipv4Address dst ("10.0.0.1");
+  Ipv4Address other ("10.0.0.2");
+  uint32_t sizes[] = { 10, 20, 30, 40 };
+  TrafficClass classes[] = { CLASS_ROUTINE, CLASS_URGENT, CLASS_ROUTINE, CLASS_URGENT };
+  for (uint32_t i = 0; i < 4; ++i)
+    {
+      QueueEntry e = MakeEntry (dst, sizes[i], classes[i]);
+      NS_TEST_EXPECT_MSG_EQ (q.Enqueue (e), true, "Enqueue into a queue with room");
+    }
+  QueueEntry e = MakeEntry (other, 50, CLASS_ROUTINE);
+  q.Enqueue (e);
+  NS_TEST_EXPECT_MSG_EQ (q.GetSize (), 5, "Packets of both destinations held");
+  NS_TEST_EXPECT_MSG_EQ (q.GetDestinations ().size (), 2, "Two destinations waiting");
+
+  std::vector<QueueEntry> batch = q.DequeueAll (dst);
+  uint32_t expected[] = { 20, 40, 10, 30 };
+  NS_TEST_ASSERT_MSG_EQ (batch.size (), 4, "Whole batch of the destination released");
+  for (uint32_t i = 0; i < 4; ++i)
+    {
+      NS_TEST_EXPECT_MSG_EQ (batch[i].GetPacket ()->GetSize (), expected[i], "Release order at " << i);
+    }
+  NS_TEST_EXPECT_MSG_EQ (q.GetSize (), 1, "Other destination untouched");
+  NS_TEST_EXPECT_MSG_EQ (q.Find (dst), false, "Released destination gone");
+  NS_TEST_EXPECT_MSG_EQ (q.DequeueAll (dst).size (), 0, "Nothing left to release");
+}
+
+// The oldest packet of the lowest class makes room, unless the new one is lower still
+void
+CarpPacketQueueTest::CheckOverflow ()
+{
+  m_drops = 0;
+  PacketQueue q (2, Seconds (30));
+  q.SetDropCallback (MakeCallback (&CarpPacketQueueTest::Dropped, this));
+  Ipv4Address dst ("10.0.0.1");
+  QueueEntry r1 = MakeEntry (dst, 1, CLASS_ROUTINE);
+  QueueEntry r2 = MakeEntry (dst, 2, CLASS_ROUTINE);
+  QueueEntry u3 = MakeEntry (dst, 3, CLASS_URGENT);
+  q.Enqueue (r1);
+  q.Enqueue (r2);
+  NS_TEST_EXPECT_MSG_EQ (q.Enqueue (u3), true, "Urgent packet accepted into a full queue");
+  NS_TEST_EXPECT_MSG_EQ (q.GetOverflowDrops (), 1, "One overflow drop");
+  NS_TEST_EXPECT_MSG_EQ (m_drops, 1, "Drop reported through the callback");
+  std::vector<QueueEntry> batch = q.DequeueAll (dst);
+  NS_TEST_ASSERT_MSG_EQ (batch.size (), 2, "Queue stays at its bound");
+  NS_TEST_EXPECT_MSG_EQ (batch[0].GetPacket ()->GetSize (), 3, "Urgent packet first");
+  NS_TEST_EXPECT_MSG_EQ (batch[1].GetPacket ()->GetSize (), 2, "Oldest routine packet dropped");
+
+  QueueEntry u4 = MakeEntry (dst, 4, CLASS_URGENT);
+  QueueEntry u5 = MakeEntry (dst, 5, CLASS_URGENT);
+  QueueEntry r6 = MakeEntry (dst, 6, CLASS_ROUTINE);
+  q.Enqueue (u4);
+  q.Enqueue (u5);
+  NS_TEST_EXPECT_MSG_EQ (q.Enqueue (r6), false, "Routine packet refused by a queue full of urgent ones");
+  NS_TEST_EXPECT_MSG_EQ (q.GetOverflowDrops (), 2, "Refusal counted as an overflow drop");
+  NS_TEST_EXPECT_MSG_EQ (m_drops, 2, "Refusal reported through the callback");
+  NS_TEST_EXPECT_MSG_EQ (q.GetSize (), 2, "Urgent packets kept");
+}
+
+// Packets older than the queue timeout are dropped on the next access
+void
+CarpPacketQueueTest::CheckPurge ()
+{
+  m_drops = 0;
+  PacketQueue q (8, Seconds (1));
+  q.SetDropCallback (MakeCallback (&CarpPacketQueueTest::Dropped, this));
+  QueueEntry e1 = MakeEntry (Ipv4Address ("10.0.0.1"), 10, CLASS_ROUTINE);
+  QueueEntry e2 = MakeEntry (Ipv4Address ("10.0.0.2"), 10, CLASS_URGENT);
+  q.Enqueue (e1);
+  q.Enqueue (e2);
+  Simulator::Stop (Seconds (2));
+  Simulator::Run ();
+  NS_TEST_EXPECT_MSG_EQ (q.GetHeldSize (), 2, "Nothing purged without an access");
+  NS_TEST_EXPECT_MSG_EQ (q.GetSize (), 0, "Outdated packets purged");
+  NS_TEST_EXPECT_MSG_EQ (q.GetTimeoutDrops (), 2, "Both counted as timeout drops");
+  NS_TEST_EXPECT_MSG_EQ (q.GetOverflowDrops (), 0, "No overflow");
+  NS_TEST_EXPECT_MSG_EQ (m_drops, 2, "Both reported through the callback");
+  NS_TEST_EXPECT_MSG_EQ (q.GetDestinations ().size (), 0, "No destination left");
+  Simulator::Destroy ();
+}
+
+void
+CarpPacketQueueTest::DoRun ()
+{
+  CheckOrder ();
+  CheckOverflow ();
+  CheckPurge ();
+}
+
+//-----------------------------------------------------------------------------
+// Headers
+//-----------------------------------------------------------------------------
+class CarpHeaderTest : public TestCase
+{
+public:
+  CarpHeaderTest () : TestCase ("CARP header serialization round trips") {}
+  virtual void DoRun ();
+
+private:
+  template <typename T>
+  T RoundTrip (const T &h);
+};
+
+template <typename T>
+T
+CarpHeaderTest::RoundTrip (const T &h)
+{
+  Ptr<Packet> p = Create<Packet> ();
+  p->AddHeader (h);
+  NS_TEST_EXPECT_MSG_EQ (p->GetSize (), h.GetSerializedSize (), "Serialized size");
+  T out;
+  uint32_t bytes = p->RemoveHeader (out);
+  NS_TEST_EXPECT_MSG_EQ (bytes, h.GetSerializedSize (), "Deserialized size");
+  NS_TEST_EXPECT_MSG_EQ (p->GetSize (), 0, "Header fully consumed");
+  return out;
+}
+
+void
+CarpHeaderTest::DoRun ()
+{
+  {
+    TypeHeader h (CARPTYPE_DATA_ACK);
+    TypeHeader out = RoundTrip (h);
+    NS_TEST_EXPECT_MSG_EQ (out.IsValid (), true, "Known type");
+    NS_TEST_EXPECT_MSG_EQ (out == h, true, "Type round trip");
+
+    uint8_t unknown = 99;
+    Ptr<Packet> p = Create<Packet> (&unknown, 1);
+    TypeHeader bad;
+    p->RemoveHeader (bad);
+    NS_TEST_EXPECT_MSG_EQ (bad.IsValid (), false, "Unknown type rejected");
+  }
+  {
+    PingHeader h (42, Ipv4Address ("10.1.2.3"), 7);
+    PingHeader out = RoundTrip (h);
+    NS_TEST_EXPECT_MSG_EQ (out == h, true, "PING round trip");
+    NS_TEST_EXPECT_MSG_EQ (out.GetPacketCount (), 42, "PING packet count");
+    NS_TEST_EXPECT_MSG_EQ (out.GetHopCount (), 7, "PING hop count");
+  }
+  {
+    PongHeader h (12, 3, Ipv4Address ("10.0.0.9"), Ipv4Address ("10.0.0.4"), 0.5, 0.25);
+    PongHeader out = RoundTrip (h);
+    NS_TEST_EXPECT_MSG_EQ (out.GetQueue (), 12, "PONG queue");
+    NS_TEST_EXPECT_MSG_EQ (out.GetHopCount (), 3, "PONG hop count");
+    NS_TEST_EXPECT_MSG_EQ (out.GetDst (), Ipv4Address ("10.0.0.9"), "PONG destination");
+    NS_TEST_EXPECT_MSG_EQ (out.GetOrigin (), Ipv4Address ("10.0.0.4"), "PONG origin");
+    // Energy and link quality travel quantized to 8 bits
+    NS_TEST_EXPECT_MSG_EQ_TOL (out.GetEnergy (), 0.5, 1.0 / 255, "PONG energy");
+    NS_TEST_EXPECT_MSG_EQ_TOL (out.GetLinkQuality (), 0.25, 1.0 / 255, "PONG link quality");
+  }
+  {
+    HelloHeader h (4, Ipv4Address ("10.0.0.5"));
+    h.SetPosition (Vector (12.34, -56.78, 9.0));
+    h.SetRound (65000);
+    h.SetSink (Ipv4Address ("10.0.0.1"));
+    HelloHeader out = RoundTrip (h);
+    NS_TEST_EXPECT_MSG_EQ (out == h, true, "HELLO round trip");
+    NS_TEST_EXPECT_MSG_EQ (out.GetSink (), Ipv4Address ("10.0.0.1"), "HELLO sink");
+    // Positions travel in centimetres
+    NS_TEST_EXPECT_MSG_EQ_TOL (out.GetPosition ().x, 12.34, 0.01, "HELLO x");
+    NS_TEST_EXPECT_MSG_EQ_TOL (out.GetPosition ().y, -56.78, 0.01, "HELLO y");
+    NS_TEST_EXPECT_MSG_EQ_TOL (out.GetPosition ().z, 9.0, 0.01, "HELLO z");
+  }
+  {
+    DataAckHeader h (Ipv4Address ("10.0.0.7"), 4321);
+    DataAckHeader out = RoundTrip (h);
+    NS_TEST_EXPECT_MSG_EQ (out == h, true, "DATA_ACK round trip");
+  }
+  {
+    AggregateHeader h;
+    h.AddPacket (100);
+    h.AddPacket (1500);
+    h.AddPacket (65535);
+    NS_TEST_EXPECT_MSG_EQ (h.GetSerializedSize (), 7, "Count and three sizes");
+    AggregateHeader out = RoundTrip (h);
+    NS_TEST_ASSERT_MSG_EQ (out.GetNPackets (), 3, "Aggregate packet count");
+    NS_TEST_EXPECT_MSG_EQ (out.GetPacketSize (0), 100, "First size");
+    NS_TEST_EXPECT_MSG_EQ (out.GetPacketSize (1), 1500, "Second size");
+    NS_TEST_EXPECT_MSG_EQ (out.GetPacketSize (2), 65535, "Third size");
+
+    AggregateHeader empty;
+    NS_TEST_EXPECT_MSG_EQ (RoundTrip (empty).GetNPackets (), 0, "Empty aggregate");
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Statistics
+//-----------------------------------------------------------------------------
+class CarpQuantileSketchTest : public TestCase
+{
+public:
+  CarpQuantileSketchTest () : TestCase ("P-square quantile estimates") {}
+  virtual void DoRun ();
+};
+
+void
+CarpQuantileSketchTest::DoRun ()
+{
+  QuantileSketch none (0.5);
+  NS_TEST_EXPECT_MSG_EQ (none.Get (), 0.0, "No sample");
+
+  // Exact below five samples
+  QuantileSketch few (0.5);
+  few.Add (3);
+  few.Add (1);
+  few.Add (2);
+  NS_TEST_EXPECT_MSG_EQ (few.Get (), 2.0, "Median of three samples");
+
+  // 0 .. 9999 in a scrambled order, so the markers do not see a sorted stream
+  QuantileSketch median (0.5);
+  QuantileSketch p90 (0.9);
+  QuantileSketch p99 (0.99);
+  for (uint32_t i = 0; i < 10000; ++i)
+    {
+      double x = (i * 7919) % 10000;
+      median.Add (x);
+      p90.Add (x);
+      p99.Add (x);
+    }
+  NS_TEST_EXPECT_MSG_EQ (median.GetCount (), 10000, "Samples counted");
+  NS_TEST_EXPECT_MSG_EQ_TOL (median.Get (), 5000, 100, "Median of a uniform stream");
+  NS_TEST_EXPECT_MSG_EQ_TOL (p90.Get (), 9000, 100, "90th percentile of a uniform stream");
+  NS_TEST_EXPECT_MSG_EQ_TOL (p99.Get (), 9900, 100, "99th percentile of a uniform stream");
+}
+
+class CarpRunningStatsTest : public TestCase
+{
+public:
+  CarpRunningStatsTest () : TestCase ("Streaming mean, variance and confidence half width") {}
+  virtual void DoRun ();
+};
+
+void
+CarpRunningStatsTest::DoRun ()
+{
+  RunningStats s;
+  NS_TEST_EXPECT_MSG_EQ (s.GetVariance (), 0.0, "No variance without samples");
+  s.Add (2);
+  NS_TEST_EXPECT_MSG_EQ (s.GetVariance (), 0.0, "No variance from one sample");
+  NS_TEST_EXPECT_MSG_GT (s.GetHalfWidth (1.96), 1e300, "Unbounded interval from one sample");
+  double xs[] = { 4, 4, 4, 5, 5, 7, 9 };
+  for (uint32_t i = 0; i < 7; ++i)
+    {
+      s.Add (xs[i]);
+    }
+  NS_TEST_EXPECT_MSG_EQ (s.GetCount (), 8, "Count");
+  NS_TEST_EXPECT_MSG_EQ_TOL (s.GetMean (), 5.0, 1e-12, "Mean");
+  NS_TEST_EXPECT_MSG_EQ_TOL (s.GetVariance (), 32.0 / 7, 1e-12, "Unbiased variance");
+  NS_TEST_EXPECT_MSG_EQ_TOL (s.GetHalfWidth (1.96), 1.96 * std::sqrt (32.0 / 7 / 8), 1e-12, "Half width");
+}
+
+class CarpEarlyStopTest : public TestCase
+{
+public:
+  CarpEarlyStopTest () : TestCase ("Batch-means stopping rule") {}
+  virtual void DoRun ();
+
+private:
+  void SendBatch (Ptr<EarlyStop> es, uint32_t sent, uint32_t received, Time delay);
+};
+
+void
+CarpEarlyStopTest::SendBatch (Ptr<EarlyStop> es, uint32_t sent, uint32_t received, Time delay)
+{
+  for (uint32_t i = 0; i < sent; ++i)
+    {
+      es->NotifySent ();
+    }
+  for (uint32_t i = 0; i < received; ++i)
+    {
+      es->NotifyReceived (delay);
+    }
+}
+
+void
+CarpEarlyStopTest::DoRun ()
+{
+  // Every batch delivers 9 of 10 packets after 100 ms: the intervals collapse, so only MinBatches holds the run
+  Ptr<EarlyStop> es = Create<EarlyStop> (Seconds (1));
+  es->SetPdrHalfWidth (0.05);
+  es->SetDelayHalfWidth (0.1);
+  es->SetMinBatches (5);
+  es->Start (Seconds (0));
+  // Traffic before the first batch opens is warm-up and not counted
+  es->NotifySent ();
+  for (uint32_t k = 0; k < 20; ++k)
+    {
+      Simulator::Schedule (Seconds (k + 0.5), &CarpEarlyStopTest::SendBatch, this, es, 10, 9, MilliSeconds (100));
+    }
+  Simulator::Stop (Seconds (30));
+  Simulator::Run ();
+  NS_TEST_EXPECT_MSG_EQ (es->IsConverged (), true, "Converged");
+  NS_TEST_EXPECT_MSG_EQ (es->GetStopTime (), Seconds (5), "Stopped at the end of the fifth batch");
+  NS_TEST_EXPECT_MSG_EQ (Simulator::Now (), Seconds (5), "Simulation stopped with it");
+  NS_TEST_EXPECT_MSG_EQ (es->GetPdr ().GetCount (), 5, "One PDR sample per batch");
+  NS_TEST_EXPECT_MSG_EQ_TOL (es->GetPdr ().GetMean (), 0.9, 1e-12, "Batch PDR");
+  NS_TEST_EXPECT_MSG_EQ_TOL (es->GetDelay ().GetMean (), 0.1, 1e-9, "Batch mean delay");
+  NS_TEST_EXPECT_MSG_EQ_TOL (es->GetDelayP99 (), 0.1, 1e-9, "Delay 99th percentile");
+  Simulator::Destroy ();
+
+  // Alternating batches keep the PDR interval wide: no stop before the simulation ends
+  es = Create<EarlyStop> (Seconds (1));
+  es->SetPdrHalfWidth (0.01);
+  es->SetMinBatches (2);
+  es->Start (Seconds (0));
+  for (uint32_t k = 0; k < 10; ++k)
+    {
+      Simulator::Schedule (Seconds (k + 0.5), &CarpEarlyStopTest::SendBatch, this, es, 10,
+                           (k % 2) ? 2 : 10, MilliSeconds (100));
+    }
+  Simulator::Stop (Seconds (10));
+  Simulator::Run ();
+  NS_TEST_EXPECT_MSG_EQ (es->IsConverged (), false, "Noisy PDR does not converge");
+  // Nine batches closed before the stop: five full ones and four at 20%
+  NS_TEST_EXPECT_MSG_EQ (es->GetPdr ().GetCount (), 9, "Batches closed");
+  NS_TEST_EXPECT_MSG_EQ_TOL (es->GetPdr ().GetMean (), 5.8 / 9, 1e-12, "Mean of the alternating batches");
+  Simulator::Destroy ();
+}
+
+//-----------------------------------------------------------------------------
+class CarpTestSuite : public TestSuite
+{
+public:
+  CarpTestSuite () : TestSuite ("routing-carp", UNIT)
+  {
+    AddTestCase (new CarpPacketQueueTest, TestCase::QUICK);
+    AddTestCase (new CarpHeaderTest, TestCase::QUICK);
+    AddTestCase (new CarpQuantileSketchTest, TestCase::QUICK);
+    AddTestCase (new CarpRunningStatsTest, TestCase::QUICK);
+    AddTestCase (new CarpEarlyStopTest, TestCase::QUICK);
+  }
+} g_carpTestSuite;